@@ -199,8 +199,18 @@ typedef struct BytePSContext {
       part_comm_time;
   // Compressor list
   std::vector<std::shared_ptr<compressor::Compressor>> compressor_list;
+  // Compressor list for pulled data, may share with compressor_list
+  std::vector<std::shared_ptr<compressor::Compressor>> pull_compressor_list;
   // kwargs
   std::unordered_map<std::string, std::string> kwargs;
+  // aggregated through the tree of BYTEPS_AGGREGATION_GROUP_SIZE
+  bool aggregation_tree = false;
+  // updated by the optimizer on servers, see BYTEPS_SERVER_OPTIMIZER
+  bool server_update = false;
+  // elements per row if pushed and pulled as row-sparse, 0 otherwise
+  int row_sparse_dim = 0;
+  // per-partition buffers of the encoded rows
+  std::vector<std::unique_ptr<char[]>> row_sparse_buff;
 } BPSContext;
 
 class Tensor {
@@ -258,8 +268,12 @@ struct TensorTableEntry {
   unsigned int total_partnum = 0;
   // Compressor
   std::shared_ptr<compressor::Compressor> compressor;
+  // Compressor for pulled data
+  std::shared_ptr<compressor::Compressor> pull_compressor;
   // Compressed
   std::shared_ptr<compressor::tensor_t> compressed;
+  // Pulled data has been decompressed into the host tensor directly
+  bool pulled_to_host = false;
 };
 using TensorTable = std::unordered_map<std::string, TensorTableEntry>;
 
@@ -267,7 +281,9 @@ enum class RequestType {
   kDefaultPushPull,
   kRowSparsePushPull,
   kCompressedPushPull,
-  kConfigPushPull
+  kConfigPushPull,
+  // init push of a key updated by the optimizer on servers
+  kServerUpdatePushPull
 };
 
 int GetCommandType(RequestType requestType, int d);
@@ -291,6 +307,31 @@ inline void Promote(size_t& size, int& dtype) {
     dtype = BYTEPS_FLOAT32;
   }
 }
+
+// Keys of the aggregation tree (BYTEPS_AGGREGATION_GROUP_SIZE). Workers of
+// a group push to the partial key of the group. The group leader pulls the
+// partial sum, pushes it to the root key, pulls the total sum and pushes it
+// to the result key, from which the rest of the group pulls.
+// Tensor keys use the lower 32 bits, and servers keep the top 16 bits.
+constexpr int kTreeGroupShift = 32;
+constexpr uint64_t kTreeGroupMask = (1ULL << 14) - 1;
+constexpr uint64_t kTreeResultFlag = 1ULL << 46;
+constexpr uint64_t kTreeRootFlag = 1ULL << 47;
+
+inline uint64_t GetTreeRootKey(uint64_t key) { return key | kTreeRootFlag; }
+
+inline uint64_t GetTreePartialKey(uint64_t key, int group) {
+  return key | ((static_cast<uint64_t>(group) + 1) << kTreeGroupShift);
+}
+
+inline uint64_t GetTreeResultKey(uint64_t key, int group) {
+  return GetTreePartialKey(key, group) | kTreeResultFlag;
+}
+
+// group of a partial or result key, -1 for other keys
+inline int GetTreeGroup(uint64_t key) {
+  return static_cast<int>((key >> kTreeGroupShift) & kTreeGroupMask) - 1;
+}
 }  // namespace common
 }  // namespace byteps
 
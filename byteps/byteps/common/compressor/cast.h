@@ -44,6 +44,12 @@ class Cast : public Compressor {
 
   void Decompress(tensor_t compressed, tensor_t& output) final;
 
+  void ForEachBuffer(const std::function<void(void*, size_t)>& func) final {
+    Compressor::ForEachBuffer(func);
+    func(_fp32_buf.get(), _size);
+    _cptr->ForEachBuffer(func);
+  }
+
  protected:
   /*!
    * \brief Cast low-precision gradients into float32
@@ -14,6 +14,7 @@
 #ifndef BYTEPS_COMPRESSOR_COMPRESSOR_H
 #define BYTEPS_COMPRESSOR_COMPRESSOR_H
 
+#include <functional>
 #include <memory>
 
 #include "../common.h"
@@ -117,6 +118,16 @@ class Compressor {
     BPS_CHECK(0) << "not implemented error.";
   };
 
+  /*!
+   * \brief apply func to the buffers of the compressor and of the compressor
+   * it wraps, e.g., to move them to another numa node
+   *
+   * \param func called with the address and the size of each buffer
+   */
+  virtual void ForEachBuffer(const std::function<void(void*, size_t)>& func) {
+    func(_buf.get(), _size);
+  }
+
  protected:
   /*! \brief buffer's size */
   size_t _size;
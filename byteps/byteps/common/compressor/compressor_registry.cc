@@ -15,6 +15,8 @@
 
 #include <vector>
 
+#include "header.h"
+
 namespace byteps {
 namespace common {
 namespace compressor {
@@ -67,6 +69,12 @@ std::unique_ptr<Compressor> CompressorRegistry::Create(kwargs_t kwargs,
       auto ctor = CompressorRegistry::Find(iter->second + "_" + type);
       internal_cptr =
           std::move(ctor(kwargs, size, dtype, std::move(internal_cptr)));
+      // make the payload self-describing right above the real compressor
+      if (type == "compressor_type") {
+        internal_cptr.reset(new HeaderCompressor(
+            size, dtype, GetCompressorAlgo(iter->second),
+            std::move(internal_cptr)));
+      }
     }
   }
 
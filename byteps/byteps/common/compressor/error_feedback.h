@@ -55,6 +55,11 @@ class ErrorFeedback : public Compressor {
 
   void Decompress(tensor_t compressed, tensor_t& output) final;
 
+  void ForEachBuffer(const std::function<void(void*, size_t)>& func) final {
+    Compressor::ForEachBuffer(func);
+    _cptr->ForEachBuffer(func);
+  }
+
  protected:
   /*!
    * \brief Correct gradient with error
@@ -0,0 +1,109 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "header.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+CompressorAlgo GetCompressorAlgo(const std::string& name) {
+  static const std::unordered_map<std::string, CompressorAlgo> algo_map = {
+      {"onebit", CompressorAlgo::kOnebit},
+      {"topk", CompressorAlgo::kTopk},
+      {"randomk", CompressorAlgo::kRandomk},
+      {"dithering", CompressorAlgo::kDithering},
+  };
+  auto iter = algo_map.find(name);
+  if (iter == algo_map.end()) return CompressorAlgo::kUnknown;
+  return iter->second;
+}
+
+const PayloadHeader* ParseHeader(const tensor_t& compressed) {
+  BPS_CHECK(compressed.data);
+  BPS_CHECK_GE(compressed.size, sizeof(PayloadHeader))
+      << "compressed payload is smaller than its header";
+  auto header = reinterpret_cast<const PayloadHeader*>(compressed.data);
+  BPS_CHECK_EQ(header->magic, kPayloadMagic)
+      << "compressed payload has no valid header";
+  BPS_CHECK_EQ(static_cast<int>(header->version),
+               static_cast<int>(kPayloadVersion))
+      << "unsupported compressed payload version";
+  return header;
+}
+
+template <typename F>
+void HeaderCompressor::CompressWithHeader(tensor_t grad, tensor_t& output,
+                                          F&& func) {
+  if (output.data == nullptr) {
+    output.data = _buf.get();
+  }
+  auto header = reinterpret_cast<PayloadHeader*>(output.data);
+  auto payload = output.data + sizeof(PayloadHeader);
+
+  tensor_t inner{payload};
+  func(inner);
+  // some compressors (e.g. randomk on servers) return the input as is
+  if (inner.data != payload) {
+    std::memmove(payload, inner.data, inner.size);
+  }
+
+  header->magic = kPayloadMagic;
+  header->version = kPayloadVersion;
+  header->algo = static_cast<uint8_t>(_algo);
+  header->dtype = static_cast<uint8_t>(grad.dtype);
+  header->flags = 0;
+  if (_algo == CompressorAlgo::kTopk) {
+    header->flags |= kIndexedPayload | kSparsePayload;
+  } else if (_algo == CompressorAlgo::kRandomk) {
+    header->flags |= kSparsePayload;
+  }
+  header->reserved = 0;
+  header->num_elem = grad.size / getDataTypeLength(grad.dtype);
+
+  output.size = sizeof(PayloadHeader) + inner.size;
+}
+
+void HeaderCompressor::Compress(tensor_t grad, tensor_t& output) {
+  CompressWithHeader(grad, output,
+                     [&](tensor_t& inner) { _cptr->Compress(grad, inner); });
+}
+
+void HeaderCompressor::FusedCompress(tensor_t grad, tensor_t& output,
+                                     tensor_t error) {
+  CompressWithHeader(grad, output, [&](tensor_t& inner) {
+    _cptr->FusedCompress(grad, inner, error);
+  });
+}
+
+void HeaderCompressor::Decompress(tensor_t compressed, tensor_t& output) {
+  auto header = ParseHeader(compressed);
+  BPS_CHECK_EQ(static_cast<int>(header->algo), static_cast<int>(_algo))
+      << "compressed payload is produced by a different compressor";
+  if (output.data) {
+    BPS_CHECK_LE(header->num_elem * getDataTypeLength(output.dtype),
+                 output.size)
+        << "compressed payload has more elements than the output";
+  }
+
+  tensor_t payload{compressed.data + sizeof(PayloadHeader),
+                   compressed.size - sizeof(PayloadHeader), compressed.dtype};
+  _cptr->Decompress(payload, output);
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,124 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_HEADER_H
+#define BYTEPS_COMPRESSOR_HEADER_H
+
+#include <string>
+
+#include "compressor.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*! \brief algorithm id carried in the payload header */
+enum class CompressorAlgo : uint8_t {
+  kUnknown = 0,
+  kOnebit = 1,
+  kTopk = 2,
+  kRandomk = 3,
+  kDithering = 4
+};
+
+/*! \brief flags carried in the payload header */
+enum PayloadFlag : uint8_t {
+  // payload is a list of (index, value) pairs
+  kIndexedPayload = 1 << 0,
+  // payload only carries a few entries of the original tensor
+  kSparsePayload = 1 << 1
+};
+
+/*!
+ * \brief fixed-size header in front of every compressed payload
+ *
+ * 16 bytes so that the payload behind it stays 8-byte aligned.
+ */
+struct PayloadHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t algo;
+  uint8_t dtype;
+  uint8_t flags;
+  uint16_t reserved;
+  uint64_t num_elem;
+};
+static_assert(sizeof(PayloadHeader) == 16, "PayloadHeader should be 16 bytes");
+
+constexpr uint16_t kPayloadMagic = 0x4243;
+constexpr uint8_t kPayloadVersion = 1;
+
+/*!
+ * \brief map compressor name (e.g. "topk") to its algorithm id
+ */
+CompressorAlgo GetCompressorAlgo(const std::string& name);
+
+/*!
+ * \brief validate and return the header of a compressed payload
+ *
+ * \param compressed compressed tensor with header
+ * \return pointer to the header inside the payload
+ */
+const PayloadHeader* ParseHeader(const tensor_t& compressed);
+
+/*!
+ * \brief Wrapper of Compressor to make compressed payloads self-describing
+ *
+ * Compress writes a `PayloadHeader` (algorithm id, format version, element
+ * count, dtype and flags) before the payload of the wrapped compressor.
+ * Decompress validates the header and strips it before forwarding. It wraps
+ * the innermost compressor, so error-feedback and momentum stay unaware of it.
+ *
+ * The wrapper has an internal buffer to store header and payload together.
+ *
+ * \sa Compressor
+ */
+class HeaderCompressor : public Compressor {
+ public:
+  HeaderCompressor(size_t size, DataType dtype, CompressorAlgo algo,
+                   std::unique_ptr<Compressor> cptr)
+      : Compressor(size + sizeof(PayloadHeader), dtype),
+        _algo(algo),
+        _cptr(std::move(cptr)){};
+  ~HeaderCompressor() override = default;
+
+  void Compress(tensor_t grad, tensor_t& output) final;
+
+  void Decompress(tensor_t compressed, tensor_t& output) final;
+
+  void ForEachBuffer(const std::function<void(void*, size_t)>& func) final {
+    Compressor::ForEachBuffer(func);
+    _cptr->ForEachBuffer(func);
+  }
+
+  void FusedCompress(tensor_t grad, tensor_t& output, tensor_t error) final;
+
+ private:
+  /*!
+   * \brief reserve room for the header and let `func` fill the payload
+   */
+  template <typename F>
+  void CompressWithHeader(tensor_t grad, tensor_t& output, F&& func);
+
+ private:
+  /*! \brief algorithm id of the wrapped compressor */
+  CompressorAlgo _algo;
+
+  /*! \brief compressor pointer */
+  std::unique_ptr<Compressor> _cptr;
+};
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_HEADER_H
@@ -50,6 +50,11 @@ class Momentum : public Compressor {
 
   void Decompress(tensor_t compressed, tensor_t& output) final;
 
+  void ForEachBuffer(const std::function<void(void*, size_t)>& func) final {
+    Compressor::ForEachBuffer(func);
+    _cptr->ForEachBuffer(func);
+  }
+
  protected:
   /*!
    * \brief Update momentum
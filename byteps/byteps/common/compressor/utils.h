@@ -66,6 +66,47 @@ inline kwargs_t Deserialize(const std::string& content) {
   return kwargs;
 }
 
+/*!
+ * \brief extract hyper-params of the pull direction (server -> worker)
+ *
+ * pull-side hyper-params carry a "pull_" prefix, e.g. "pull_compressor_type"
+ * and "pull_ef_type". if no pull-side compressor is given, the pull direction
+ * shares the push-side hyper-params.
+ *
+ * \note randomk relies on the same random indices for both directions, so it
+ * can not be mixed with a separate pull compressor.
+ *
+ * \param kwargs hyper-params of both directions
+ * \return kwargs_t hyper-params of the pull direction
+ */
+inline kwargs_t GetPullKwargs(const kwargs_t& kwargs) {
+  const std::string prefix = "pull_";
+  auto iter = kwargs.find(prefix + "compressor_type");
+  if (iter == kwargs.end()) {
+    return kwargs;
+  }
+
+  auto push_iter = kwargs.find("compressor_type");
+  BPS_CHECK(iter->second != "randomk" &&
+            (push_iter == kwargs.end() || push_iter->second != "randomk"))
+      << "randomk compressor can not be used with a separate pull compressor";
+
+  kwargs_t pull_kwargs;
+  for (auto const& kwarg : kwargs) {
+    if (kwarg.first.compare(0, prefix.size(), prefix) == 0) {
+      pull_kwargs[kwarg.first.substr(prefix.size())] = kwarg.second;
+    }
+  }
+
+  // seed is shared by both directions
+  auto seed_iter = kwargs.find("seed");
+  if (seed_iter != kwargs.end() && !pull_kwargs.count("seed")) {
+    pull_kwargs["seed"] = seed_iter->second;
+  }
+
+  return pull_kwargs;
+}
+
 /*!
  * \brief random number generator based on xorshift128plus
  *
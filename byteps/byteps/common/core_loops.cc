@@ -17,13 +17,16 @@
 
 #include <cuda_runtime.h>
 
+#include <atomic>
 #include <chrono>
 #include <memory>
 
 #include "common.h"
 #include "compressor/compressor.h"
+#include "compressor/header.h"
 #include "global.h"
 #include "logging.h"
+#include "row_sparse.h"
 
 namespace byteps {
 namespace common {
@@ -480,11 +483,16 @@ bool RunPcieReduceLoopOnce() {
       if (copy_len) {
         auto total_offset = offset + nccl_rank * num_elem_per_gpu * unit_len;
 
-        // Below we assume there are only two PCIe switch
-        // and we run reducer in the context of the second switch
+        // We run reducer in the context of the last switch, whose buffer is
+        // task->cpubuff, and sum the buffers of all switches into it in one
+        // pass
+        std::vector<const void *> srcs;
+        srcs.push_back((char *)(task->cpubuff) + total_offset);
+        for (size_t k = 0; k + 1 < task->pcie_cpubuff.size(); ++k) {
+          srcs.push_back((char *)(task->pcie_cpubuff[k]) + total_offset);
+        }
         reducer->sum((void *)((char *)(task->cpubuff) + total_offset),
-                     (void *)((char *)(task->pcie_cpubuff[0]) + total_offset),
-                     copy_len, tensor->dtype());
+                     srcs.data(), srcs.size(), copy_len, tensor->dtype());
       }
     }
 
@@ -536,6 +544,25 @@ bool RunCompressLoopOnce() {
   return true;
 }
 
+// buffer of the encoded rows of a row-sparse partition
+char *GetRowSparseBuff(std::shared_ptr<TensorTableEntry> task) {
+  auto context = task->context;
+  auto i = task->key - context->key_list.front();
+  BPS_CHECK_LT(i, context->row_sparse_buff.size());
+  return context->row_sparse_buff[i].get();
+}
+
+// the pulled result of a row-sparse partition is encoded if it is shorter
+// than the partition, decode it in place
+void DecodeRowSparsePull(std::shared_ptr<TensorTableEntry> task, char *data) {
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+  size_t size = pskv.lens[0];
+  if (size >= task->len) return;
+  auto buff = GetRowSparseBuff(task);
+  memcpy(buff, data, size);
+  DecodeRowSparse(buff, size, data, task->len);
+}
+
 bool RunPushLoopOnce() {
   QueueType this_op = PUSH;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
@@ -555,6 +582,7 @@ bool RunPushLoopOnce() {
 
       // get metadata
       const int dtype = task->tensor->dtype();
+      int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
 
       // use compressed data/len
       if (task->compressed) {
@@ -563,13 +591,59 @@ bool RunPushLoopOnce() {
         len = task->compressed->size;
       }
 
+      // the pull overwrites the push buffer, except that the rows of a
+      // row-sparse partition are decoded into the partition itself
+      auto pull_data = data;
+      auto row_sparse_dim = task->context->row_sparse_dim;
+      if (row_sparse_dim > 0) {
+        // only push the non-zero rows, unless the partition is too dense
+        auto buff = GetRowSparseBuff(task);
+        size_t row_bytes = row_sparse_dim * getDataTypeLength(dtype);
+        auto size = EncodeRowSparse(data, len, row_bytes, nullptr, buff);
+        if (size) {
+          data = buff;
+          len = size;
+          cmd = GetCommandType(RequestType::kRowSparsePushPull, dtype);
+        }
+      }
+
       // false means not to delete data when SArray is deleted
       ps::SArray<char> vals(data, len, false);
 
-      int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-      auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
-      BytePSGlobal::GetPS()->ZPush(pskv.keys, vals, pskv.lens, cmd,
-                                   [task, q]() { FinishOrProceed(task); });
+      auto key = task->key;
+      if (task->context->aggregation_tree) {
+        key = GetTreePartialKey(key, BytePSGlobal::GetAggregationGroup());
+      }
+      auto &pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+      if (row_sparse_dim > 0) {
+        // the last pull may have left the length of an encoded result
+        pskv.lens[0] = len;
+      }
+      if (BytePSGlobal::IsProactivePull()) {
+        // post the pull right away, the server parks it and responds as soon
+        // as all pushes are summed, which saves the round trip of issuing it
+        // after the push completes. the received data overwrites the push
+        // buffer, but only after the server has received the push.
+        auto pending = std::make_shared<std::atomic_int>(2);
+        auto done = [task, pending]() {
+          if (pending->fetch_sub(1) == 1) FinishOrProceed(task);
+        };
+        BytePSGlobal::GetPS()->ZPush(pskv.keys, vals, pskv.lens, cmd, done);
+
+        auto pull_vals = new ps::SArray<char>(pull_data, task->len, false);
+        int pull_cmd =
+            GetCommandType(RequestType::kDefaultPushPull, task->output->dtype());
+        BytePSGlobal::GetPS()->ZPull(
+            pskv.keys, pull_vals, &pskv.lens, pull_cmd,
+            [pull_vals, done, task, pull_data, row_sparse_dim]() {
+              delete pull_vals;
+              if (row_sparse_dim > 0) DecodeRowSparsePull(task, pull_data);
+              done();
+            });
+      } else {
+        BytePSGlobal::GetPS()->ZPush(pskv.keys, vals, pskv.lens, cmd,
+                                     [task, q]() { FinishOrProceed(task); });
+      }
     } else {
       // This is a dummy barrier for IsCrossPcieSwitch()
       BPS_CHECK(BytePSGlobal::IsCrossPcieSwitch());
@@ -581,6 +655,44 @@ bool RunPushLoopOnce() {
   return true;
 }
 
+// pull from the aggregation tree. the group leader relays the partial sum
+// of its group to the root key, and the total sum back to the group.
+void TreePull(std::shared_ptr<TensorTableEntry> task, char *data, size_t len,
+              int cmd) {
+  auto group = BytePSGlobal::GetAggregationGroup();
+  auto ps = BytePSGlobal::GetPS();
+  auto pull = [ps, data, len, cmd](uint64_t key, std::function<void()> cb) {
+    auto &pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+    auto vals = new ps::SArray<char>(data, len, false);
+    ps->ZPull(pskv.keys, vals, &pskv.lens, cmd, [vals, cb]() {
+      delete vals;
+      cb();
+    });
+  };
+  auto push = [ps, data, len, cmd](uint64_t key, std::function<void()> cb) {
+    auto &pskv = BytePSGlobal::EncodeDefaultKey(key, len);
+    ps::SArray<char> vals(data, len, false);
+    ps->ZPush(pskv.keys, vals, pskv.lens, cmd, cb);
+  };
+
+  auto key = task->key;
+  if (!BytePSGlobal::IsAggregationLeader()) {
+    pull(GetTreeResultKey(key, group), [task]() { FinishOrProceed(task); });
+    return;
+  }
+  pull(GetTreePartialKey(key, group), [=]() {
+    push(GetTreeRootKey(key), [=]() {
+      pull(GetTreeRootKey(key), [=]() {
+        if (BytePSGlobal::GetAggregationGroupWorkers() == 1) {
+          FinishOrProceed(task);
+          return;
+        }
+        push(GetTreeResultKey(key, group), [task]() { FinishOrProceed(task); });
+      });
+    });
+  });
+}
+
 bool RunPullLoopOnce() {
   QueueType this_op = PULL;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
@@ -606,15 +718,23 @@ bool RunPullLoopOnce() {
       data = task->compressed->data;
     }
 
+    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+    if (task->context->aggregation_tree) {
+      TreePull(task, data, len, cmd);
+      return true;
+    }
+
     // false means not to delete data when SArray is deleted
     auto vals = new ps::SArray<char>(data, len, false);
 
-    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
     auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
     // issue pull
     BytePSGlobal::GetPS()->ZPull(pskv.keys, vals, &pskv.lens, cmd,
-                                 [vals, task, q]() {
+                                 [vals, task, q, data]() {
                                    delete vals;
+                                   if (task->context->row_sparse_dim > 0) {
+                                     DecodeRowSparsePull(task, data);
+                                   }
                                    FinishOrProceed(task);
                                  });
   } else {
@@ -630,7 +750,7 @@ bool RunDecompressLoopOnce() {
   if (task) {
     BPS_CHECK(BytePSGlobal::IsRootDevice())
         << "only root device should enter DECOMPRESS loop";
-    BPS_CHECK(task->compressor != nullptr);
+    BPS_CHECK(task->pull_compressor != nullptr);
 
     // spawn
     BytePSGlobal::GetThreadPool()->enqueue([task]() {
@@ -642,7 +762,21 @@ bool RunDecompressLoopOnce() {
       compressor::tensor_t compressed{task->compressed->data, len},
           output(data, task->len, dtype);
 
-      task->compressor->Decompress(compressed, output);
+      // sparse results of host tensors are decompressed directly into the
+      // tensor that COPYH2D would write, i.e., the input, which skips the
+      // dense cpubuff and the copy. it still holds the local gradient, so
+      // the decompressor zeroes all of it before writing the pulled entries.
+      if (BytePSGlobal::IsDirectSparsePull() &&
+          task->device == CPU_DEVICE_ID &&
+          BytePSGlobal::GetLocalSize() == 1 &&
+          (compressor::ParseHeader(compressed)->flags &
+           compressor::kSparsePayload)) {
+        output.data = const_cast<char *>(
+            static_cast<const char *>(task->tensor->data()) + task->offset);
+        task->pulled_to_host = true;
+      }
+
+      task->pull_compressor->Decompress(compressed, output);
 
       task->compressed = nullptr;
       FinishOrProceed(task);
@@ -656,6 +790,9 @@ bool RunDecompressLoopOnce() {
 }
 
 void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
+  // already written to the host tensor in DECOMPRESS
+  if (task->pulled_to_host) return;
+
   auto copy_h2d_stream = BytePSGlobal::GetCopyHost2DeviceStream();
   auto tensor = task->output;
   BPS_CHECK(tensor);
@@ -17,19 +17,347 @@
 #include "global.h"
 #endif
 
+#include <omp.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <limits>
+#include <mutex>
+#include <string>
 
 #include "cpu_reducer.h"
-#if __F16C__
+// this file is built for the baseline instruction set, so that the scalar
+// paths run on any x86-64, and half_t converts in software there. The F16C
+// conversions are in the kernels below, which are picked at runtime.
+#undef MSHADOW_USE_F16C
+#define MSHADOW_USE_F16C 0
 #include "half.h"
 using half_t = mshadow::half::half_t;
-#else
-using half_t = void;
-#endif
 
 namespace byteps {
 namespace common {
 
+namespace {
+
+// type to accumulate T in over several sources
+template <typename T>
+struct Accum {
+  using type = T;
+};
+
+template <>
+struct Accum<half_t> {
+  using type = float;
+};
+
+// dst[i] = srcs[0][i] + ... + srcs[num_srcs - 1][i] for i in [begin, end),
+// adding the sources in order. A loop over the sources of one element would
+// be vectorized as a reduction, i.e., reordered under -Ofast, so they are
+// added a block of elements at a time.
+template <typename T>
+void SumScalar(T* dst, const T* const* srcs, size_t num_srcs, size_t begin,
+               size_t end) {
+  using A = typename Accum<T>::type;
+  constexpr size_t kBlock = 256;
+  A acc[kBlock];
+  for (size_t b = begin; b < end; b += kBlock) {
+    size_t m = std::min(kBlock, end - b);
+    for (size_t j = 0; j < m; ++j) acc[j] = static_cast<A>(srcs[0][b + j]);
+    for (size_t k = 1; k < num_srcs; ++k) {
+      auto src = srcs[k] + b;
+      for (size_t j = 0; j < m; ++j) acc[j] += static_cast<A>(src[j]);
+    }
+    for (size_t j = 0; j < m; ++j) dst[b + j] = acc[j];
+  }
+}
+
+#if BYTEPS_CPU_REDUCER_SIMD
+
+#define BYTEPS_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#define BYTEPS_TARGET_AVX512 \
+  __attribute__((target("avx512f,avx512bw,avx2,f16c")))
+#define BYTEPS_INLINE_AVX2 \
+  __attribute__((always_inline, target("avx2,f16c"))) inline
+#define BYTEPS_INLINE_AVX512 \
+  __attribute__((always_inline, target("avx512f,avx512bw,avx2,f16c"))) inline
+
+/**
+ * \brief vector load, store and add of T with the instruction set L
+ *
+ * Float16 is loaded into float32 vectors and summed in float32, like the
+ * scalar operators of half_t.
+ */
+template <typename T, CpuReducer::SimdLevel L>
+struct Vec;
+
+#define BYTEPS_DEFINE_VEC(T, L, ATTR, VT, LANES, LOAD, STORE, ADD) \
+  template <>                                                      \
+  struct Vec<T, CpuReducer::L> {                                   \
+    using V = VT;                                                  \
+    static constexpr size_t kLanes = LANES;                        \
+    ATTR static V Load(const T* p) { return LOAD; }                \
+    ATTR static void Store(T* p, V v) { STORE; }                   \
+    ATTR static V Add(V a, V b) { return ADD(a, b); }              \
+  }
+
+BYTEPS_DEFINE_VEC(float, AVX2, BYTEPS_INLINE_AVX2, __m256, 8,
+                  _mm256_loadu_ps(p), _mm256_storeu_ps(p, v),
+                  _mm256_add_ps);
+BYTEPS_DEFINE_VEC(double, AVX2, BYTEPS_INLINE_AVX2, __m256d, 4,
+                  _mm256_loadu_pd(p), _mm256_storeu_pd(p, v),
+                  _mm256_add_pd);
+BYTEPS_DEFINE_VEC(int32_t, AVX2, BYTEPS_INLINE_AVX2, __m256i, 8,
+                  _mm256_loadu_si256((const __m256i*)p),
+                  _mm256_storeu_si256((__m256i*)p, v), _mm256_add_epi32);
+BYTEPS_DEFINE_VEC(int64_t, AVX2, BYTEPS_INLINE_AVX2, __m256i, 4,
+                  _mm256_loadu_si256((const __m256i*)p),
+                  _mm256_storeu_si256((__m256i*)p, v), _mm256_add_epi64);
+BYTEPS_DEFINE_VEC(int8_t, AVX2, BYTEPS_INLINE_AVX2, __m256i, 32,
+                  _mm256_loadu_si256((const __m256i*)p),
+                  _mm256_storeu_si256((__m256i*)p, v), _mm256_add_epi8);
+BYTEPS_DEFINE_VEC(uint8_t, AVX2, BYTEPS_INLINE_AVX2, __m256i, 32,
+                  _mm256_loadu_si256((const __m256i*)p),
+                  _mm256_storeu_si256((__m256i*)p, v), _mm256_add_epi8);
+
+BYTEPS_DEFINE_VEC(float, AVX512, BYTEPS_INLINE_AVX512, __m512, 16,
+                  _mm512_loadu_ps(p), _mm512_storeu_ps(p, v),
+                  _mm512_add_ps);
+BYTEPS_DEFINE_VEC(double, AVX512, BYTEPS_INLINE_AVX512, __m512d, 8,
+                  _mm512_loadu_pd(p), _mm512_storeu_pd(p, v),
+                  _mm512_add_pd);
+BYTEPS_DEFINE_VEC(int32_t, AVX512, BYTEPS_INLINE_AVX512, __m512i, 16,
+                  _mm512_loadu_si512(p), _mm512_storeu_si512(p, v),
+                  _mm512_add_epi32);
+BYTEPS_DEFINE_VEC(int64_t, AVX512, BYTEPS_INLINE_AVX512, __m512i, 8,
+                  _mm512_loadu_si512(p), _mm512_storeu_si512(p, v),
+                  _mm512_add_epi64);
+BYTEPS_DEFINE_VEC(int8_t, AVX512, BYTEPS_INLINE_AVX512, __m512i, 64,
+                  _mm512_loadu_si512(p), _mm512_storeu_si512(p, v),
+                  _mm512_add_epi8);
+BYTEPS_DEFINE_VEC(uint8_t, AVX512, BYTEPS_INLINE_AVX512, __m512i, 64,
+                  _mm512_loadu_si512(p), _mm512_storeu_si512(p, v),
+                  _mm512_add_epi8);
+
+// vcvtph2ps and vcvtps2ph, rounding to nearest even as _cvtss_sh in half_t
+BYTEPS_DEFINE_VEC(half_t, AVX2, BYTEPS_INLINE_AVX2, __m256, 8,
+                  _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p)),
+                  _mm_storeu_si128((__m128i*)p,
+                                   _mm256_cvtps_ph(v,
+                                                   _MM_FROUND_TO_NEAREST_INT)),
+                  _mm256_add_ps);
+// the zero-masked forms avoid the undefined source vectors of the unmasked
+// ones, which some compilers warn about
+BYTEPS_DEFINE_VEC(half_t, AVX512, BYTEPS_INLINE_AVX512, __m512, 16,
+                  _mm512_maskz_cvtph_ps(0xffff,
+                                        _mm256_loadu_si256((const __m256i*)p)),
+                  _mm256_storeu_si256(
+                      (__m256i*)p,
+                      _mm512_maskz_cvtps_ph(0xffff, v,
+                                            _MM_FROUND_TO_NEAREST_INT)),
+                  _mm512_add_ps);
+
+#undef BYTEPS_DEFINE_VEC
+
+// dst[i] = dst[i] + src[i], where S is converted to D
+template <typename D, typename S>
+BYTEPS_TARGET_AVX2 void SumAvx2(D* __restrict__ dst, const S* __restrict__ src,
+                                size_t n) {
+  using VD = Vec<D, CpuReducer::AVX2>;
+  using VS = Vec<S, CpuReducer::AVX2>;
+  static_assert(VD::kLanes == VS::kLanes, "mismatched vectors");
+  // whole vectors, then the tail
+  size_t body = n / VD::kLanes * VD::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VD::kLanes) {
+    VD::Store(dst + i, VD::Add(VD::Load(dst + i), VS::Load(src + i)));
+  }
+  for (; i < n; ++i) dst[i] = dst[i] + static_cast<D>(src[i]);
+}
+
+// dst[i] = src1[i] + src2[i]
+template <typename T>
+BYTEPS_TARGET_AVX2 void SumAvx2(T* __restrict__ dst, const T* __restrict__ src1,
+                                const T* __restrict__ src2, size_t n) {
+  using VT = Vec<T, CpuReducer::AVX2>;
+  size_t body = n / VT::kLanes * VT::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VT::kLanes) {
+    VT::Store(dst + i, VT::Add(VT::Load(src1 + i), VT::Load(src2 + i)));
+  }
+  for (; i < n; ++i) dst[i] = src1[i] + src2[i];
+}
+
+// dst[i] = srcs[0][i] + ... + srcs[num_srcs - 1][i] for i in [begin, end).
+// dst may be one of srcs.
+template <typename T>
+BYTEPS_TARGET_AVX2 void SumAvx2(T* dst, const T* const* srcs,
+                                size_t num_srcs, size_t begin, size_t end) {
+  using VT = Vec<T, CpuReducer::AVX2>;
+  size_t body = begin + (end - begin) / VT::kLanes * VT::kLanes;
+  size_t i = begin;
+  for (; i < body; i += VT::kLanes) {
+    auto v = VT::Load(srcs[0] + i);
+    for (size_t k = 1; k < num_srcs; ++k) {
+      v = VT::Add(v, VT::Load(srcs[k] + i));
+    }
+    VT::Store(dst + i, v);
+  }
+  SumScalar(dst, srcs, num_srcs, body, end);
+}
+
+// dst[i] = src[i], converting S to D
+template <typename D, typename S>
+BYTEPS_TARGET_AVX2 void ConvertAvx2(D* __restrict__ dst,
+                                    const S* __restrict__ src, size_t n) {
+  using VD = Vec<D, CpuReducer::AVX2>;
+  using VS = Vec<S, CpuReducer::AVX2>;
+  static_assert(VD::kLanes == VS::kLanes, "mismatched vectors");
+  size_t body = n / VD::kLanes * VD::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VD::kLanes) {
+    VD::Store(dst + i, VS::Load(src + i));
+  }
+  for (; i < n; ++i) dst[i] = src[i];
+}
+
+template <typename D, typename S>
+BYTEPS_TARGET_AVX512 void SumAvx512(D* __restrict__ dst,
+                                    const S* __restrict__ src, size_t n) {
+  using VD = Vec<D, CpuReducer::AVX512>;
+  using VS = Vec<S, CpuReducer::AVX512>;
+  static_assert(VD::kLanes == VS::kLanes, "mismatched vectors");
+  size_t body = n / VD::kLanes * VD::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VD::kLanes) {
+    VD::Store(dst + i, VD::Add(VD::Load(dst + i), VS::Load(src + i)));
+  }
+  for (; i < n; ++i) dst[i] = dst[i] + static_cast<D>(src[i]);
+}
+
+template <typename T>
+BYTEPS_TARGET_AVX512 void SumAvx512(T* __restrict__ dst,
+                                    const T* __restrict__ src1,
+                                    const T* __restrict__ src2, size_t n) {
+  using VT = Vec<T, CpuReducer::AVX512>;
+  size_t body = n / VT::kLanes * VT::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VT::kLanes) {
+    VT::Store(dst + i, VT::Add(VT::Load(src1 + i), VT::Load(src2 + i)));
+  }
+  for (; i < n; ++i) dst[i] = src1[i] + src2[i];
+}
+
+template <typename T>
+BYTEPS_TARGET_AVX512 void SumAvx512(T* dst, const T* const* srcs,
+                                    size_t num_srcs, size_t begin,
+                                    size_t end) {
+  using VT = Vec<T, CpuReducer::AVX512>;
+  size_t body = begin + (end - begin) / VT::kLanes * VT::kLanes;
+  size_t i = begin;
+  for (; i < body; i += VT::kLanes) {
+    auto v = VT::Load(srcs[0] + i);
+    for (size_t k = 1; k < num_srcs; ++k) {
+      v = VT::Add(v, VT::Load(srcs[k] + i));
+    }
+    VT::Store(dst + i, v);
+  }
+  SumScalar(dst, srcs, num_srcs, body, end);
+}
+
+template <typename D, typename S>
+BYTEPS_TARGET_AVX512 void ConvertAvx512(D* __restrict__ dst,
+                                        const S* __restrict__ src, size_t n) {
+  using VD = Vec<D, CpuReducer::AVX512>;
+  using VS = Vec<S, CpuReducer::AVX512>;
+  static_assert(VD::kLanes == VS::kLanes, "mismatched vectors");
+  size_t body = n / VD::kLanes * VD::kLanes;
+  size_t i = 0;
+  for (; i < body; i += VD::kLanes) {
+    VD::Store(dst + i, VS::Load(src + i));
+  }
+  for (; i < n; ++i) dst[i] = src[i];
+}
+
+// copy with streaming stores, which neither read dst into the caches nor
+// evict other data for it. SSE2 is always available on x86-64, and is
+// enough to saturate the memory bandwidth.
+void CopyNonTemporal(char* __restrict__ dst, const char* __restrict__ src,
+                     size_t n) {
+  size_t i = std::min(n, (16 - reinterpret_cast<uintptr_t>(dst) % 16) % 16);
+  std::memcpy(dst, src, i);
+  for (; i + 64 <= n; i += 64) {
+    auto s = reinterpret_cast<const __m128i*>(src + i);
+    auto d = reinterpret_cast<__m128i*>(dst + i);
+    auto v0 = _mm_loadu_si128(s);
+    auto v1 = _mm_loadu_si128(s + 1);
+    auto v2 = _mm_loadu_si128(s + 2);
+    auto v3 = _mm_loadu_si128(s + 3);
+    _mm_stream_si128(d, v0);
+    _mm_stream_si128(d + 1, v1);
+    _mm_stream_si128(d + 2, v2);
+    _mm_stream_si128(d + 3, v3);
+  }
+  for (; i + 16 <= n; i += 16) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+  }
+  std::memcpy(dst + i, src + i, n - i);
+  // streaming stores are weakly ordered, make them visible to the thread
+  // that uses dst next
+  _mm_sfence();
+}
+
+#endif  // BYTEPS_CPU_REDUCER_SIMD
+
+// smaller buffers take a few microseconds at most, about what waking up the
+// OpenMP threads costs
+constexpr size_t kSingleThreadThreshold = 64 << 10;
+
+// size of the last level cache
+size_t GetLastLevelCacheSize() {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  auto size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size > 0) return size;
+  size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) return size;
+#endif
+  return 32 << 20;
+}
+
+CpuReducer::SimdLevel DetectSimdLevel() {
+  auto level = CpuReducer::SCALAR;
+#if BYTEPS_CPU_REDUCER_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    level = CpuReducer::AVX512;
+  } else if (__builtin_cpu_supports("avx2") &&
+             __builtin_cpu_supports("f16c")) {
+    level = CpuReducer::AVX2;
+  }
+#endif
+  // a lower level can be forced, e.g., to compare the kernels
+  auto env = getenv("BYTEPS_CPU_REDUCER_SIMD");
+  if (env) {
+    std::string name(env);
+    CpuReducer::SimdLevel forced = CpuReducer::SCALAR;
+    if (name == "avx512") {
+      forced = CpuReducer::AVX512;
+    } else if (name == "avx2") {
+      forced = CpuReducer::AVX2;
+    } else {
+      BPS_CHECK_EQ(name, "scalar") << "unknown BYTEPS_CPU_REDUCER_SIMD";
+    }
+    level = std::min(level, forced);
+  }
+  return level;
+}
+
+}  // namespace
+
+
 CpuReducer::CpuReducer(std::shared_ptr<BytePSComm> comm) {
 #ifndef BYTEPS_BUILDING_SERVER
   std::vector<int> peers;
@@ -49,10 +377,85 @@ CpuReducer::CpuReducer(std::shared_ptr<BytePSComm> comm) {
   } else {
     _num_threads = 4;
   }
+  _simd = DetectSimdLevel();
+  _non_temporal_threshold = GetLastLevelCacheSize();
+  if (getenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD")) {
+    _single_thread_threshold =
+        strtoull(getenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD"),
+                 nullptr, 10);
+  } else if (getenv("BYTEPS_CPU_REDUCER_CALIBRATE") &&
+             atoi(getenv("BYTEPS_CPU_REDUCER_CALIBRATE"))) {
+    // all reducers of a process have the same threads, calibrate once
+    static std::once_flag calibrated;
+    static size_t threshold;
+    std::call_once(calibrated,
+                   [&] { threshold = _calibrate_single_thread_threshold(); });
+    _single_thread_threshold = threshold;
+  } else {
+    _single_thread_threshold = kSingleThreadThreshold;
+  }
+  BPS_LOG(DEBUG) << "CpuReducer uses "
+                 << (_simd == AVX512 ? "avx512"
+                                     : _simd == AVX2 ? "avx2" : "scalar")
+                 << " kernels, " << _num_threads << " threads above "
+                 << _single_thread_threshold << " bytes, non-temporal copies "
+                 << "above " << _non_temporal_threshold << " bytes";
 
   return;
 }
 
+size_t CpuReducer::_calibrate_single_thread_threshold() {
+  constexpr size_t kMinLen = 4 << 10;
+  constexpr size_t kMaxLen = 4 << 20;
+  constexpr int kRepeats = 5;
+  if (_num_threads <= 1) return std::numeric_limits<size_t>::max();
+
+  std::vector<float> dst(kMaxLen / sizeof(float));
+  std::vector<float> src(kMaxLen / sizeof(float), 1);
+  // best time of summing len bytes with the given threshold
+  auto time = [&](size_t len,
+                  size_t threshold) -> std::chrono::nanoseconds {
+    _single_thread_threshold = threshold;
+    auto best = std::chrono::nanoseconds::max();
+    for (int i = 0; i < kRepeats; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      _sum(dst.data(), src.data(), len);
+      best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start));
+    }
+    return best;
+  };
+  // start the threads and fault in the buffers
+  time(kMaxLen, 0);
+  for (size_t len = kMinLen; len < kMaxLen; len *= 2) {
+    if (time(len, 0) < time(len, std::numeric_limits<size_t>::max())) {
+      return len;
+    }
+  }
+  return kMaxLen;
+}
+
+template <typename T, typename F>
+void CpuReducer::_parallel_for(size_t len, F f) {
+  size_t num_elem = len / sizeof(T);
+  if (len < _single_thread_threshold) {
+    // not worth waking up the other threads
+    if (num_elem) f(0, num_elem);
+    return;
+  }
+#pragma omp parallel num_threads(_num_threads)
+  {
+    size_t num_threads = omp_get_num_threads();
+    size_t tid = omp_get_thread_num();
+    // whole cache lines of any type per thread
+    size_t chunk = (num_elem + num_threads - 1) / num_threads;
+    chunk = (chunk + 63) / 64 * 64;
+    size_t begin = std::min(num_elem, tid * chunk);
+    size_t end = std::min(num_elem, begin + chunk);
+    if (begin < end) f(begin, end);
+  }
+}
+
 #ifndef BYTEPS_BUILDING_SERVER
 bool CpuReducer::isRoot() {
   if (!_comm) {
@@ -94,7 +497,21 @@ int CpuReducer::sum(void* dst, const void* src, size_t len, DataType dtype) {
 template <typename T>
 int CpuReducer::_sum(T* __restrict__ dst, const T* __restrict__ src,
                      size_t len) {
-#pragma omp parallel for simd num_threads(_num_threads)
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx512(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx2(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
   for (size_t i = 0; i < len / (size_t)sizeof(T); ++i) {
     dst[i] = dst[i] + src[i];
   }
@@ -141,23 +558,121 @@ int CpuReducer::sum(void* dst, const void* src1, const void* src2, size_t len,
 template <typename T>
 int CpuReducer::_sum(T* __restrict__ dst, const T* __restrict__ src1,
                      const T* __restrict__ src2, size_t len) {
-#pragma omp parallel for simd num_threads(_num_threads)
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx512(dst + begin, src1 + begin, src2 + begin, end - begin);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx2(dst + begin, src1 + begin, src2 + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
   for (size_t i = 0; i < len / (size_t)sizeof(T); ++i) {
     dst[i] = src1[i] + src2[i];
   }
   return 0;
 }
 
+int CpuReducer::sum(void* dst, const void* const* srcs, size_t num_srcs,
+                    size_t len, DataType dtype) {
+  BPS_CHECK_GT(num_srcs, 0);
+  switch (dtype) {
+    case BYTEPS_FLOAT32:
+      return _sum(reinterpret_cast<float*>(dst), srcs, num_srcs, len);
+    case BYTEPS_FLOAT64:
+      return _sum(reinterpret_cast<double*>(dst), srcs, num_srcs, len);
+    case BYTEPS_FLOAT16:
+      return _sum(reinterpret_cast<half_t*>(dst), srcs, num_srcs, len);
+    case BYTEPS_UINT8:
+      return _sum(reinterpret_cast<uint8_t*>(dst), srcs, num_srcs, len);
+    case BYTEPS_INT32:
+      return _sum(reinterpret_cast<int32_t*>(dst), srcs, num_srcs, len);
+    case BYTEPS_INT8:
+      return _sum(reinterpret_cast<int8_t*>(dst), srcs, num_srcs, len);
+    case BYTEPS_INT64:
+      return _sum(reinterpret_cast<int64_t*>(dst), srcs, num_srcs, len);
+    default:
+      BPS_CHECK(0) << "Unsupported data type: " << dtype;
+  }
+  return 0;
+}
+
+template <typename T>
+int CpuReducer::_sum(T* dst, const void* const* srcs, size_t num_srcs,
+                     size_t len) {
+  auto src = reinterpret_cast<const T* const*>(srcs);
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx512(dst, src, num_srcs, begin, end);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx2(dst, src, num_srcs, begin, end);
+    });
+    return 0;
+  }
+#endif
+  _parallel_for<T>(len, [=](size_t begin, size_t end) {
+    SumScalar(dst, src, num_srcs, begin, end);
+  });
+  return 0;
+}
+
 int CpuReducer::copy(void* __restrict__ dst, const void* __restrict__ src,
                      size_t len) {
-  auto in = (float*)src;
-  auto out = (float*)dst;
-#pragma omp parallel for simd num_threads(_num_threads)
-  for (size_t i = 0; i < len / 4; ++i) {
-    out[i] = in[i];
+  auto in = reinterpret_cast<const char*>(src);
+  auto out = reinterpret_cast<char*>(dst);
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (len >= _non_temporal_threshold) {
+    // dst would not stay in the caches anyway
+    _parallel_for<char>(len, [=](size_t begin, size_t end) {
+      CopyNonTemporal(out + begin, in + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+  _parallel_for<char>(len, [=](size_t begin, size_t end) {
+    std::memcpy(out + begin, in + begin, end - begin);
+  });
+  return 0;
+}
+
+int CpuReducer::scale(void* dst, size_t len, DataType dtype, float alpha) {
+  switch (dtype) {
+    case BYTEPS_FLOAT32:
+      return _scale(reinterpret_cast<float*>(dst), len, alpha);
+    case BYTEPS_FLOAT64:
+      return _scale(reinterpret_cast<double*>(dst), len, alpha);
+    case BYTEPS_FLOAT16:
+      return _scale(reinterpret_cast<half_t*>(dst), len, alpha);
+    case BYTEPS_UINT8:
+      return _scale(reinterpret_cast<uint8_t*>(dst), len, alpha);
+    case BYTEPS_INT32:
+      return _scale(reinterpret_cast<int32_t*>(dst), len, alpha);
+    case BYTEPS_INT8:
+      return _scale(reinterpret_cast<int8_t*>(dst), len, alpha);
+    case BYTEPS_INT64:
+      return _scale(reinterpret_cast<int64_t*>(dst), len, alpha);
+    default:
+      BPS_CHECK(0) << "Unsupported data type: " << dtype;
   }
-  if (len % 4) {
-    std::memcpy(out + len / 4, in + len / 4, len % 4);
+  return 0;
+}
+
+template <typename T>
+int CpuReducer::_scale(T* dst, size_t len, float alpha) {
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
+  for (size_t i = 0; i < len / (size_t)sizeof(T); ++i) {
+    dst[i] = static_cast<T>(dst[i] * alpha);
   }
   return 0;
 }
@@ -176,9 +691,24 @@ int CpuReducer::sum_mixed_precision(void* dst, const void* src, size_t len,
 template <typename T>
 int CpuReducer::_sum_mixed_precision(float* __restrict__ dst,
                                      const T* __restrict__ src, size_t len) {
-#pragma omp parallel for simd num_threads(_num_threads)
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx512(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      SumAvx2(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
   for (size_t i = 0; i < len / (size_t)sizeof(T); ++i) {
-    dst[i] += src[i];
+    // float + half_t would be rounded to half_t
+    dst[i] += static_cast<float>(src[i]);
   }
   return 0;
 }
@@ -212,7 +742,21 @@ template <typename T>
 int CpuReducer::_copy_mixed_precision_up(float* __restrict__ dst,
                                          const T* __restrict__ src,
                                          size_t len) {
-#pragma omp parallel for simd num_threads(_num_threads)
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      ConvertAvx512(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      ConvertAvx2(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
   for (size_t i = 0; i < len / sizeof(T); ++i) {
     dst[i] = src[i];
   }
@@ -223,7 +767,21 @@ template <typename T>
 int CpuReducer::_copy_mixed_precision_down(T* __restrict__ dst,
                                            const float* __restrict__ src,
                                            size_t len) {
-#pragma omp parallel for simd num_threads(_num_threads)
+#if BYTEPS_CPU_REDUCER_SIMD
+  if (_simd == AVX512) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      ConvertAvx512(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  } else if (_simd == AVX2) {
+    _parallel_for<T>(len, [=](size_t begin, size_t end) {
+      ConvertAvx2(dst + begin, src + begin, end - begin);
+    });
+    return 0;
+  }
+#endif
+#pragma omp parallel for simd num_threads(_num_threads) \
+    if (len >= _single_thread_threshold)
   for (size_t i = 0; i < len / sizeof(T); ++i) {
     dst[i] = src[i];
   }
@@ -16,8 +16,10 @@
 #ifndef BYTEPS_CPU_REDUCER_H
 #define BYTEPS_CPU_REDUCER_H
 
-#if __AVX__ && __F16C__
-#include <cpuid.h>
+#if __x86_64__ && __GNUC__
+// kernels of each instruction set are compiled with target attributes and
+// picked at runtime
+#define BYTEPS_CPU_REDUCER_SIMD 1
 #include <immintrin.h>
 #endif
 
@@ -41,6 +43,11 @@ namespace common {
 
 class CpuReducer {
  public:
+  /*!
+   * \brief instruction sets of the kernels
+   */
+  enum SimdLevel { SCALAR, AVX2, AVX512 };
+
   CpuReducer(std::shared_ptr<BytePSComm> comm);
   ~CpuReducer() {
     if (_comm) _comm.reset();
@@ -51,6 +58,17 @@ class CpuReducer {
   int sum(void* dst, const void* src1, const void* src2, size_t len,
           DataType dtype);
 
+  /*!
+   * \brief dst = srcs[0] + ... + srcs[num_srcs - 1] in a single pass
+   *
+   * dst is written once, and may be one of srcs. The sources are added in
+   * order, so the result has the same bits as a sequence of pairwise sums,
+   * except for float16: it is accumulated in float32 and rounded once,
+   * where pairwise sums round every partial sum.
+   */
+  int sum(void* dst, const void* const* srcs, size_t num_srcs, size_t len,
+          DataType dtype);
+
   int sum_mixed_precision(void* dst, const void* src, size_t len,
                           DataType dtype);
 
@@ -59,6 +77,8 @@ class CpuReducer {
   int copy_mixed_precision(void* dst, const void* src, size_t len,
                            DataType dtype, bool up);
 
+  int scale(void* dst, size_t len, DataType dtype, float alpha);
+
 #ifndef BYTEPS_BUILDING_SERVER
   bool isRoot();
   std::shared_ptr<BytePSComm> getComm() { return _comm; }
@@ -66,7 +86,27 @@ class CpuReducer {
 
   DataType GetDataType(int dtype) { return static_cast<DataType>(dtype); }
 
+  SimdLevel GetSimdLevel() const { return _simd; }
+
+  size_t GetSingleThreadThreshold() const { return _single_thread_threshold; }
+
  private:
+  /*!
+   * \brief run f(begin, end) on ranges of the len / sizeof(T) elements, in
+   *        parallel unless len is below _single_thread_threshold
+   */
+  template <typename T, typename F>
+  void _parallel_for(size_t len, F f);
+
+  /*!
+   * \brief the smallest len that a parallel float32 sum is faster for
+   *
+   * It times sums with the threads of this reducer, so it is only run when
+   * BYTEPS_CPU_REDUCER_CALIBRATE is set. The result is also used for the
+   * other operations, e.g., copies.
+   */
+  size_t _calibrate_single_thread_threshold();
+
   template <typename T>
   int _sum(T* __restrict__ dst, const T* __restrict__ src, size_t len);
 
@@ -74,6 +114,12 @@ class CpuReducer {
   int _sum(T* __restrict__ dst, const T* __restrict__ src1,
            const T* __restrict__ src2, size_t len);
 
+  template <typename T>
+  int _sum(T* dst, const void* const* srcs, size_t num_srcs, size_t len);
+
+  template <typename T>
+  int _scale(T* dst, size_t len, float alpha);
+
   template <typename T>
   int _sum_mixed_precision(float* __restrict__ dst, const T* __restrict__ src,
                            size_t len);
@@ -90,7 +136,11 @@ class CpuReducer {
 
   std::shared_ptr<BytePSComm> _comm;
   int _num_threads;
+  // smaller buffers are handled by the calling thread alone
   size_t _single_thread_threshold;
+  // larger copies bypass the caches
+  size_t _non_temporal_threshold;
+  SimdLevel _simd;
 };
 
 }  // namespace common
@@ -42,6 +42,9 @@ bool BytePSGlobal::_is_distributed_job;
 bool BytePSGlobal::_is_cross_pcie_switch;
 uint32_t BytePSGlobal::_partition_bytes = 4096000;
 uint32_t BytePSGlobal::_min_compress_bytes = 0;
+bool BytePSGlobal::_is_direct_sparse_pull = false;
+bool BytePSGlobal::_is_proactive_pull = false;
+int BytePSGlobal::_aggregation_group_size = 0;
 
 int BytePSGlobal::_is_trace = 0;
 int BytePSGlobal::_start_step = 10;
@@ -138,6 +141,18 @@ void BytePSGlobal::Init() {
   if (getenv("BYTEPS_MIN_COMPRESS_BYTES")) {
     _min_compress_bytes = atoi(getenv("BYTEPS_MIN_COMPRESS_BYTES"));
   }
+  if (getenv("BYTEPS_DIRECT_SPARSE_PULL")) {
+    _is_direct_sparse_pull = atoi(getenv("BYTEPS_DIRECT_SPARSE_PULL"));
+  }
+  if (getenv("BYTEPS_PROACTIVE_PULL")) {
+    _is_proactive_pull = atoi(getenv("BYTEPS_PROACTIVE_PULL"));
+  }
+  if (getenv("BYTEPS_AGGREGATION_GROUP_SIZE")) {
+    _aggregation_group_size = atoi(getenv("BYTEPS_AGGREGATION_GROUP_SIZE"));
+    BPS_CHECK_GE(_aggregation_group_size, 0);
+    BPS_CHECK(!_aggregation_group_size || !_is_proactive_pull)
+        << "BYTEPS_PROACTIVE_PULL does not work with the aggregation tree";
+  }
   _pagesize = sysconf(_SC_PAGESIZE);
   BPS_CHECK_GT(_pagesize, 0);
   _partition_bytes = RoundUp(_partition_bytes, _local_size * _pagesize);
@@ -448,7 +463,19 @@ void BytePSGlobal::RegisterCompressor(
     ss << kv.first << ":" << kv.second << ",\t";
   }
   BPS_LOG(DEBUG) << ss.str();
-  _name_to_cxt[name].kwargs = std::move(kwargs);
+  auto& context = _name_to_cxt[name];
+  // not an argument of the compressor
+  auto iter = kwargs.find("server_update");
+  if (iter != kwargs.end()) {
+    context.server_update = (iter->second != "0");
+    kwargs.erase(iter);
+  }
+  iter = kwargs.find("row_sparse");
+  if (iter != kwargs.end()) {
+    context.row_sparse_dim = std::stoi(iter->second);
+    kwargs.erase(iter);
+  }
+  context.kwargs = std::move(kwargs);
 }
 
 // Append for communication traces
@@ -102,6 +102,19 @@ class BytePSGlobal {
 
   static uint32_t GetPartitionBound() { return _partition_bytes; }
   static uint32_t GetMinCompressBound() { return _min_compress_bytes; }
+  static bool IsDirectSparsePull() { return _is_direct_sparse_pull; }
+  static bool IsProactivePull() { return _is_proactive_pull; }
+  static int GetAggregationGroupSize() { return _aggregation_group_size; }
+  static int GetAggregationGroup() {
+    return _worker_id / _aggregation_group_size;
+  }
+  static bool IsAggregationLeader() {
+    return _worker_id % _aggregation_group_size == 0;
+  }
+  static int GetAggregationGroupWorkers() {
+    return std::min(_aggregation_group_size,
+                    _num_worker - GetAggregationGroup() * _aggregation_group_size);
+  }
 
   static cudaStream_t* GetCopyDevice2HostStream();
   static cudaStream_t* GetCopyHost2DeviceStream();
@@ -182,6 +195,9 @@ class BytePSGlobal {
 
   static uint32_t _partition_bytes;
   static uint32_t _min_compress_bytes;
+  static bool _is_direct_sparse_pull;
+  static bool _is_proactive_pull;
+  static int _aggregation_group_size;
 
   // (key, ready_signal_count) pair, only valid for root device
   static ReadyTable* _reduce_table;
@@ -171,6 +171,7 @@ void PartitionTensor(
     e->total_partnum = entry->total_partnum;
     if (!entry->context->compressor_list.empty()) {
       e->compressor = entry->context->compressor_list[i];
+      e->pull_compressor = entry->context->pull_compressor_list[i];
     }
 
     accumulated += e->len;
@@ -201,6 +202,9 @@ Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
     auto it = std::find(queue_list->begin(), queue_list->end(), PUSH);
     it = queue_list->insert(it, COMPRESS);  // before PUSH
     it = std::find(queue_list->begin(), queue_list->end(), PULL);
+    if (it == queue_list->end()) {  // pulled along with PUSH
+      it = std::find(queue_list->begin(), queue_list->end(), PUSH);
+    }
     queue_list->insert(it + 1, DECOMPRESS);  // after PULL
   }
 
@@ -363,6 +367,17 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
   if (size < BytePSGlobal::GetMinCompressBound()) {
     context.kwargs.clear();
   }
+  if (context.row_sparse_dim > 0) {
+    BPS_CHECK(context.kwargs.empty() && !context.server_update)
+        << name << ": row-sparse tensors can not be compressed or updated "
+        << "on servers";
+    BPS_CHECK_NE(dtype, BYTEPS_FLOAT16)
+        << name << ": row-sparse tensors do not support float16";
+  }
+  // compressed tensors are not aggregated through the tree
+  context.aggregation_tree = BytePSGlobal::GetAggregationGroupSize() > 0 &&
+                             context.kwargs.empty() && !context.server_update &&
+                             !context.row_sparse_dim;
   while (accumulated < size) {
     auto key = key_list[i];
     int len = ((size - accumulated) > bound) ? bound : (size - accumulated);
@@ -373,16 +388,55 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
       auto &pskv = BytePSGlobal::EncodeDefaultKey(key, len);
       // false means not to delete data when SArray is deleted
       ps::SArray<char> vals(data + accumulated, len, false);
-      // cmd type
-      int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-      // blocking push, also as a global barrirer
-      ps->Wait(ps->ZPush(pskv.keys, vals, pskv.lens, cmd));
+      // cmd type, servers learn from the init push whether to run the
+      // optimizer on the key, or to sum rows of it
+      auto type = RequestType::kDefaultPushPull;
+      if (context.server_update) {
+        type = RequestType::kServerUpdatePushPull;
+      } else if (context.row_sparse_dim > 0) {
+        type = RequestType::kRowSparsePushPull;
+        context.row_sparse_buff.emplace_back(new char[len]);
+      }
+      int cmd = GetCommandType(type, dtype);
+      if (context.aggregation_tree) {
+        // each key of the tree is initialized by the workers using it
+        auto group = BytePSGlobal::GetAggregationGroup();
+        std::vector<uint64_t> tree_keys = {GetTreePartialKey(key, group)};
+        if (BytePSGlobal::IsAggregationLeader()) {
+          tree_keys.push_back(GetTreeRootKey(key));
+        }
+        if (BytePSGlobal::GetAggregationGroupWorkers() > 1) {
+          tree_keys.push_back(GetTreeResultKey(key, group));
+        }
+        for (auto tree_key : tree_keys) {
+          auto &tree_pskv = BytePSGlobal::EncodeDefaultKey(tree_key, len);
+          ps->Wait(ps->ZPush(tree_pskv.keys, vals, tree_pskv.lens, cmd));
+        }
+      } else {
+        // blocking push, also as a global barrirer
+        ps->Wait(ps->ZPush(pskv.keys, vals, pskv.lens, cmd));
+      }
 
       // register
       if (!context.kwargs.empty()) {
         auto compressor_ptr = compressor::CompressorRegistry::Create(
             context.kwargs, len, static_cast<DataType>(dtype));
         context.compressor_list.push_back(std::move(compressor_ptr));
+
+        // pull direction shares the compressor unless configured separately
+        auto pull_kwargs = compressor::GetPullKwargs(context.kwargs);
+        if (pull_kwargs != context.kwargs) {
+          // workers only decompress pulled data
+          pull_kwargs.erase("ef_type");
+          pull_kwargs.erase("momentum_type");
+          auto pull_compressor_ptr = compressor::CompressorRegistry::Create(
+              pull_kwargs, len, static_cast<DataType>(dtype));
+          context.pull_compressor_list.push_back(
+              std::move(pull_compressor_ptr));
+        } else {
+          context.pull_compressor_list.push_back(
+              context.compressor_list.back());
+        }
       }
     }
 
@@ -464,7 +518,8 @@ std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device) {
   auto queue_list = std::make_shared<std::vector<QueueType>>();
 
   // Pull in distributed mode
-  if (BytePSGlobal::IsDistributed()) {
+  // With proactive pull, it is issued along with the push
+  if (BytePSGlobal::IsDistributed() && !BytePSGlobal::IsProactivePull()) {
     if (BytePSGlobal::IsRootDevice()) {
       queue_list->push_back(PULL);
     }
@@ -0,0 +1,146 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "row_sparse.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "logging.h"
+
+namespace byteps {
+namespace common {
+
+namespace {
+
+inline bool TestBit(const uint8_t* bitmap, size_t i) {
+  return bitmap[i / 8] & (1 << (i % 8));
+}
+
+inline void SetBit(uint8_t* bitmap, size_t i) {
+  bitmap[i / 8] |= (1 << (i % 8));
+}
+
+inline size_t NumRows(size_t len, size_t row_bytes) {
+  return (len + row_bytes - 1) / row_bytes;
+}
+
+inline size_t RowSize(size_t len, size_t row_bytes, size_t row) {
+  return std::min(row_bytes, len - row * row_bytes);
+}
+
+bool IsZero(const char* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i]) return false;
+  }
+  return true;
+}
+
+template <typename T>
+void AddRow(char* dst, const char* src, size_t len) {
+  auto d = reinterpret_cast<T*>(dst);
+  auto s = reinterpret_cast<const T*>(src);
+#pragma omp simd
+  for (size_t i = 0; i < len / sizeof(T); ++i) {
+    d[i] += s[i];
+  }
+}
+
+void AddRow(char* dst, const char* src, size_t len, DataType dtype) {
+  switch (dtype) {
+    case BYTEPS_FLOAT32:
+      return AddRow<float>(dst, src, len);
+    case BYTEPS_FLOAT64:
+      return AddRow<double>(dst, src, len);
+    case BYTEPS_INT32:
+      return AddRow<int32_t>(dst, src, len);
+    case BYTEPS_INT64:
+      return AddRow<int64_t>(dst, src, len);
+    default:
+      BPS_CHECK(0) << "Unsupported data type of row-sparse tensors: " << dtype;
+  }
+}
+
+}  // namespace
+
+size_t RowSparseBitmapSize(size_t len, size_t row_bytes) {
+  return (NumRows(len, row_bytes) + 63) / 64 * 8;
+}
+
+size_t EncodeRowSparse(const char* dense, size_t len, size_t row_bytes,
+                       const uint8_t* bitmap, char* out) {
+  BPS_CHECK_GT(row_bytes, 0);
+  auto header = reinterpret_cast<RowSparseHeader*>(out);
+  auto out_bitmap = reinterpret_cast<uint8_t*>(out + sizeof(RowSparseHeader));
+  size_t bitmap_size = RowSparseBitmapSize(len, row_bytes);
+  size_t offset = sizeof(RowSparseHeader) + bitmap_size;
+  if (offset >= len) return 0;
+  memset(out_bitmap, 0, bitmap_size);
+
+  uint32_t num_rows = 0;
+  for (size_t row = 0; row < NumRows(len, row_bytes); ++row) {
+    auto src = dense + row * row_bytes;
+    auto size = RowSize(len, row_bytes, row);
+    bool selected = bitmap ? TestBit(bitmap, row) : !IsZero(src, size);
+    if (!selected) continue;
+    // not worth it, send the dense partition instead
+    if (offset + size >= len) return 0;
+    memcpy(out + offset, src, size);
+    offset += size;
+    SetBit(out_bitmap, row);
+    ++num_rows;
+  }
+  header->row_bytes = row_bytes;
+  header->num_rows = num_rows;
+  return offset;
+}
+
+void DecodeRowSparse(const char* payload, size_t payload_len, char* dense,
+                     size_t len) {
+  auto header = reinterpret_cast<const RowSparseHeader*>(payload);
+  size_t row_bytes = header->row_bytes;
+  auto bitmap = GetRowSparseBitmap(payload);
+  size_t offset = sizeof(RowSparseHeader) + RowSparseBitmapSize(len, row_bytes);
+  for (size_t row = 0; row < NumRows(len, row_bytes); ++row) {
+    auto dst = dense + row * row_bytes;
+    auto size = RowSize(len, row_bytes, row);
+    if (TestBit(bitmap, row)) {
+      memcpy(dst, payload + offset, size);
+      offset += size;
+    } else {
+      memset(dst, 0, size);
+    }
+  }
+  BPS_CHECK_EQ(offset, payload_len) << "corrupted row-sparse payload";
+}
+
+void ScatterAddRowSparse(const char* payload, size_t payload_len, char* dense,
+                         size_t len, DataType dtype, uint8_t* bitmap) {
+  auto header = reinterpret_cast<const RowSparseHeader*>(payload);
+  size_t row_bytes = header->row_bytes;
+  auto rows = GetRowSparseBitmap(payload);
+  size_t offset = sizeof(RowSparseHeader) + RowSparseBitmapSize(len, row_bytes);
+  for (size_t row = 0; row < NumRows(len, row_bytes); ++row) {
+    if (!TestBit(rows, row)) continue;
+    auto size = RowSize(len, row_bytes, row);
+    AddRow(dense + row * row_bytes, payload + offset, size, dtype);
+    offset += size;
+    if (bitmap) SetBit(bitmap, row);
+  }
+  BPS_CHECK_EQ(offset, payload_len) << "corrupted row-sparse payload";
+}
+
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,85 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_ROW_SPARSE_H
+#define BYTEPS_ROW_SPARSE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.h"
+
+namespace byteps {
+namespace common {
+
+/*!
+ * \brief header of a row-sparse payload
+ *
+ * A partition of a tensor is viewed as rows of row_bytes (the last one may be
+ * shorter). The payload is this header, a bitmap of the rows padded to 8
+ * bytes, and then the rows set in the bitmap in ascending order. It is only
+ * used when it is smaller than the dense partition, so it always fits in the
+ * buffers of the partition.
+ */
+struct RowSparseHeader {
+  uint32_t row_bytes;
+  uint32_t num_rows;  // rows carried in the payload
+};
+static_assert(sizeof(RowSparseHeader) == 8,
+              "RowSparseHeader should be 8 bytes");
+
+/*!
+ * \brief number of bytes of the row bitmap of a partition
+ */
+size_t RowSparseBitmapSize(size_t len, size_t row_bytes);
+
+/*!
+ * \brief encode the rows of dense into out
+ *
+ * \param dense the dense partition
+ * \param len size of the partition
+ * \param row_bytes size of a row
+ * \param bitmap rows to encode, or nullptr to encode the non-zero rows
+ * \param out buffer of at least len bytes
+ * \return size of the payload, or 0 if it is not smaller than len
+ */
+size_t EncodeRowSparse(const char* dense, size_t len, size_t row_bytes,
+                       const uint8_t* bitmap, char* out);
+
+/*!
+ * \brief decode a payload into the dense partition, zeroing the other rows
+ */
+void DecodeRowSparse(const char* payload, size_t payload_len, char* dense,
+                     size_t len);
+
+/*!
+ * \brief add the rows of a payload to the dense partition
+ *
+ * \param bitmap if not nullptr, the rows of the payload are set in it
+ */
+void ScatterAddRowSparse(const char* payload, size_t payload_len, char* dense,
+                         size_t len, DataType dtype, uint8_t* bitmap);
+
+/*!
+ * \brief the row bitmap of a payload
+ */
+inline const uint8_t* GetRowSparseBitmap(const char* payload) {
+  return reinterpret_cast<const uint8_t*>(payload + sizeof(RowSparseHeader));
+}
+
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_ROW_SPARSE_H
@@ -286,6 +286,26 @@ class DistributedTrainer(mx.gluon.Trainer):
                 setattr(param, "byteps_compressor_k",
                         compression_params["k"])
 
+            # pull direction, share the push-side compressor if not given
+            if compression_params.get("pull_compressor"):
+                for item in ["compressor", "ef"]:
+                    key = "pull_%s" % item
+                    if compression_params.get(key):
+                        if isinstance(compression_params[key], str):
+                            setattr(param, "byteps_pull_%s_type" %
+                                    item, compression_params[key])
+                        else:
+                            raise TypeError("%s should be str" % key)
+
+                pull_compressor = compression_params["pull_compressor"]
+                if pull_compressor == "onebit":
+                    setattr(param, "byteps_pull_compressor_onebit_scaling", str(
+                        compression_params.get("pull_scaling", False)))
+                elif pull_compressor == "topk" or pull_compressor == "dithering":
+                    # raise KeyError if 'pull_k' is not found
+                    setattr(param, "byteps_pull_compressor_k",
+                            compression_params["pull_k"])
+
             if compression_params.get("momentum"):
                 setattr(param, "byteps_momentum_mu",
                         optimizer_params["momentum"])
@@ -0,0 +1,519 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Benchmark of the server engine without a ps-lite cluster. Simulated workers
+// push and pull keys through BytePSHandler in rounds, like the workers of a
+// synchronous job, and the responses are collected in process. Requests are
+// delivered by a single thread, as the receive thread of ps-lite does.
+//
+// Build it with the sources and flags of the server library in setup.py:
+//
+//   make -C tests/cpp server_benchmark
+//
+// The server is configured by its usual environment variables, e.g.
+//
+//   BYTEPS_SERVER_ENGINE_THREAD=8 ./server_benchmark --workers=16
+//       --keys=64 --size=4194304 --compressor=onebit
+//
+// Options (--name=value):
+//   workers         number of simulated workers (default 8)
+//   keys            number of keys (default 32)
+//   size            bytes per key pushed by a worker (default 4MB)
+//   rounds          measured rounds (default 20)
+//   warmup          rounds before measuring (default 3)
+//   dtype           float32 or float16, i.e., mixed precision (default float32)
+//   compressor      onebit, topk, randomk or dithering (default none)
+//   k               compressor_k of topk, randomk and dithering
+//   row_sparse      elements per row of row-sparse keys (default 0, dense)
+//   density         fraction of the rows pushed by a worker (default 0.01)
+//   engine_threads  sets BYTEPS_SERVER_ENGINE_THREAD
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/common.h"
+#include "../common/compressor/compressor.h"
+#include "../common/compressor/compressor_registry.h"
+#include "../common/compressor/utils.h"
+#include "../common/row_sparse.h"
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+// defined in server.h and server.cc
+extern size_t local_num_workers_;
+extern std::function<void(const ps::KVMeta&, const ps::KVPairs<char>&)>
+    response_sink_;
+void StartEngine();
+void StopEngine();
+void BytePSHandler(const ps::KVMeta& req_meta,
+                   const ps::KVPairs<char>& req_data,
+                   ps::KVServer<char>* server);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using common::RequestType;
+
+struct Options {
+  size_t workers = 8;
+  size_t keys = 32;
+  size_t size = 4 << 20;
+  size_t rounds = 20;
+  size_t warmup = 3;
+  int dtype = common::BYTEPS_FLOAT32;
+  std::string compressor;
+  std::string k;
+  size_t row_sparse = 0;
+  double density = 0.01;
+};
+
+struct Request {
+  ps::KVMeta meta{};
+  ps::KVPairs<char> data;
+  bool terminate = false;
+};
+
+/**
+ * \brief delivers the requests of all workers to BytePSHandler in order
+ */
+class Dispatcher {
+ public:
+  Dispatcher() : thread_(&Dispatcher::Run, this) {}
+
+  ~Dispatcher() {
+    Request req;
+    req.terminate = true;
+    Push(std::move(req));
+    thread_.join();
+  }
+
+  void Push(Request req) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      queue_.push_back(std::move(req));
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  void Run() {
+    while (true) {
+      Request req;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return !queue_.empty(); });
+        req = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      if (req.terminate) break;
+      BytePSHandler(req.meta, req.data, nullptr);
+    }
+  }
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_;
+  std::thread thread_;
+};
+
+class Barrier {
+ public:
+  explicit Barrier(size_t n) : n_(n) {}
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mu_);
+    auto generation = generation_;
+    if (++count_ == n_) {
+      count_ = 0;
+      ++generation_;
+      cv_.notify_all();
+    } else {
+      cv_.wait(lock, [&] { return generation != generation_; });
+    }
+  }
+
+ private:
+  size_t n_;
+  size_t count_ = 0;
+  size_t generation_ = 0;
+  std::mutex mu_;
+  std::condition_variable cv_;
+};
+
+struct Latency {
+  std::vector<double> push_us;
+  std::vector<double> pull_us;
+  std::vector<double> round_us;
+};
+
+class Worker {
+ public:
+  Worker(const Options& opts, int rank, Dispatcher* dispatcher)
+      : opts_(opts), rank_(rank), dispatcher_(dispatcher) {}
+
+  static int Sender(int rank) { return 9 + 2 * rank; }
+  static int Rank(int sender) { return (sender - 9) / 2; }
+
+  void Run(Barrier* barrier, Clock::time_point* start,
+           Clock::time_point* end) {
+    Init();
+    for (size_t r = 0; r < opts_.warmup; ++r) Round(false);
+    barrier->Wait();
+    if (rank_ == 0) *start = Clock::now();
+    for (size_t r = 0; r < opts_.rounds; ++r) Round(true);
+    barrier->Wait();
+    if (rank_ == 0) *end = Clock::now();
+  }
+
+  // called by the server threads
+  void OnResponse(const ps::KVMeta& req, const ps::KVPairs<char>& res) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mu_);
+    if (record_) {
+      double us = std::chrono::duration<double, std::micro>(
+                      now - sent_[req.timestamp])
+                      .count();
+      (req.push ? latency_.push_us : latency_.pull_us).push_back(us);
+    }
+    if (!req.push && check_) {
+      // every worker pushes ones
+      auto sum = reinterpret_cast<const float*>(res.vals.data())[0];
+      if (sum != static_cast<float>(opts_.workers)) ++errors_;
+    }
+    if (--pending_ == 0) cv_.notify_all();
+  }
+
+  const Latency& latency() const { return latency_; }
+  size_t errors() const { return errors_; }
+
+ private:
+  void Send(uint64_t key, bool push, RequestType type, char* data,
+            size_t len) {
+    Request req;
+    req.meta.cmd = common::GetCommandType(type, opts_.dtype);
+    req.meta.push = push;
+    req.meta.sender = Sender(rank_);
+    req.meta.timestamp = sent_.size();
+    req.meta.customer_id = 0;
+    req.meta.key = key;
+    req.meta.addr = 0;
+    req.meta.val_len = len;
+    req.meta.option = 0;
+    req.data.keys = ps::SArray<ps::Key>(1, key);
+    if (push) {
+      req.data.vals = ps::SArray<char>(data, len, false);
+      req.data.lens = ps::SArray<int>(1, len);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      sent_.push_back(Clock::now());
+    }
+    dispatcher_->Push(std::move(req));
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+  void Expect(size_t n) {
+    std::lock_guard<std::mutex> lock(mu_);
+    pending_ = n;
+  }
+
+  void Init() {
+    auto elem_size = common::getDataTypeLength(opts_.dtype);
+    std::mt19937 gen(rank_);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    dense_.resize(opts_.keys);
+    for (auto& buf : dense_) {
+      buf.resize(opts_.size);
+      if (opts_.dtype == common::BYTEPS_FLOAT16) {
+        auto p = reinterpret_cast<uint16_t*>(buf.data());
+        std::fill(p, p + opts_.size / elem_size, 0x3C00);  // 1.0
+      } else if (!opts_.compressor.empty()) {
+        auto p = reinterpret_cast<float*>(buf.data());
+        for (size_t i = 0; i < opts_.size / elem_size; ++i) p[i] = dist(gen);
+      } else {
+        auto p = reinterpret_cast<float*>(buf.data());
+        std::fill(p, p + opts_.size / elem_size, 1.0f);
+      }
+    }
+
+    auto init_type = opts_.row_sparse ? RequestType::kRowSparsePushPull
+                                      : RequestType::kDefaultPushPull;
+    Expect(opts_.keys);
+    for (size_t k = 0; k < opts_.keys; ++k) {
+      Send(k, true, init_type, dense_[k].data(), opts_.size);
+    }
+    Wait();
+
+    payload_ = dense_;
+    payload_len_.assign(opts_.keys, opts_.size);
+    push_type_ = RequestType::kDefaultPushPull;
+    if (!opts_.compressor.empty()) {
+      common::compressor::kwargs_t kwargs{
+          {"compressor_type", opts_.compressor}};
+      if (!opts_.k.empty()) kwargs["compressor_k"] = opts_.k;
+      config_ = common::compressor::Serialize(kwargs);
+      Expect(opts_.keys);
+      for (size_t k = 0; k < opts_.keys; ++k) {
+        Send(k, true, RequestType::kConfigPushPull, &config_[0],
+             config_.size());
+      }
+      Wait();
+      // the gradients do not change, so compress them once
+      for (size_t k = 0; k < opts_.keys; ++k) {
+        auto compressor = common::compressor::CompressorRegistry::Create(
+            kwargs, opts_.size, static_cast<common::DataType>(opts_.dtype));
+        common::compressor::tensor_t grad(dense_[k].data(), opts_.size,
+                                          opts_.dtype),
+            compressed;
+        compressor->Compress(grad, compressed);
+        if (compressed.size > opts_.size) {
+          fprintf(stderr, "compressed size %zu is larger than %zu\n",
+                  compressed.size, opts_.size);
+          exit(1);
+        }
+        memcpy(payload_[k].data(), compressed.data, compressed.size);
+        payload_len_[k] = compressed.size;
+      }
+    } else if (opts_.row_sparse) {
+      size_t row_bytes = opts_.row_sparse * elem_size;
+      size_t num_rows = (opts_.size + row_bytes - 1) / row_bytes;
+      std::bernoulli_distribution touched(opts_.density);
+      for (size_t k = 0; k < opts_.keys; ++k) {
+        std::vector<char> rows(opts_.size, 0);
+        for (size_t r = 0; r < num_rows; ++r) {
+          if (!touched(gen)) continue;
+          auto size = std::min(row_bytes, opts_.size - r * row_bytes);
+          memcpy(rows.data() + r * row_bytes, dense_[k].data() + r * row_bytes,
+                 size);
+        }
+        auto size = common::EncodeRowSparse(rows.data(), opts_.size, row_bytes,
+                                            nullptr, payload_[k].data());
+        if (size) {
+          payload_len_[k] = size;
+          push_type_ = RequestType::kRowSparsePushPull;
+        } else {
+          payload_[k] = rows;
+        }
+      }
+    }
+    auto async = getenv("BYTEPS_ENABLE_ASYNC");
+    check_ = opts_.compressor.empty() && !opts_.row_sparse &&
+             opts_.dtype == common::BYTEPS_FLOAT32 && !(async && atoi(async));
+  }
+
+  void Round(bool record) {
+    auto start = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      record_ = record;
+      pending_ = 2 * opts_.keys;
+    }
+    for (size_t k = 0; k < opts_.keys; ++k) {
+      auto type = payload_len_[k] < opts_.size ? push_type_
+                                               : RequestType::kDefaultPushPull;
+      Send(k, true, type, payload_[k].data(), payload_len_[k]);
+    }
+    for (size_t k = 0; k < opts_.keys; ++k) {
+      Send(k, false, RequestType::kDefaultPushPull, nullptr, 0);
+    }
+    Wait();
+    if (record) {
+      latency_.round_us.push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start)
+              .count());
+    }
+  }
+
+  const Options& opts_;
+  int rank_;
+  Dispatcher* dispatcher_;
+  std::vector<std::vector<char>> dense_;
+  std::vector<std::vector<char>> payload_;
+  std::vector<size_t> payload_len_;
+  RequestType push_type_;
+  std::string config_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t pending_ = 0;
+  bool record_ = false;
+  bool check_ = false;
+  size_t errors_ = 0;
+  // send time of each request, indexed by its timestamp
+  std::vector<Clock::time_point> sent_;
+  Latency latency_;
+};
+
+void PrintLatency(const char* name, std::vector<double> us) {
+  if (us.empty()) return;
+  std::sort(us.begin(), us.end());
+  auto at = [&](double q) { return us[std::min(us.size() - 1,
+                                               size_t(q * us.size()))]; };
+  printf("%-6s latency (us): p50 %10.1f  p90 %10.1f  p99 %10.1f  max %10.1f\n",
+         name, at(0.5), at(0.9), at(0.99), us.back());
+}
+
+Options ParseOptions(int argc, char** argv) {
+  std::unordered_map<std::string, std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    auto pos = arg.find('=');
+    if (arg.compare(0, 2, "--") || pos == std::string::npos) {
+      fprintf(stderr, "invalid option %s, expect --name=value\n", argv[i]);
+      exit(1);
+    }
+    args[arg.substr(2, pos - 2)] = arg.substr(pos + 1);
+  }
+  Options opts;
+  auto get = [&](const char* name, size_t* val) {
+    auto it = args.find(name);
+    if (it == args.end()) return;
+    *val = std::stoull(it->second);
+    args.erase(it);
+  };
+  get("workers", &opts.workers);
+  get("keys", &opts.keys);
+  get("size", &opts.size);
+  get("rounds", &opts.rounds);
+  get("warmup", &opts.warmup);
+  get("row_sparse", &opts.row_sparse);
+  if (args.count("dtype")) {
+    if (args["dtype"] == "float16") {
+      opts.dtype = common::BYTEPS_FLOAT16;
+    } else if (args["dtype"] != "float32") {
+      fprintf(stderr, "unsupported dtype %s\n", args["dtype"].c_str());
+      exit(1);
+    }
+    args.erase("dtype");
+  }
+  if (args.count("compressor")) {
+    opts.compressor = args["compressor"];
+    args.erase("compressor");
+  }
+  if (args.count("k")) {
+    opts.k = args["k"];
+    args.erase("k");
+  }
+  if (args.count("density")) {
+    opts.density = std::stod(args["density"]);
+    args.erase("density");
+  }
+  if (args.count("engine_threads")) {
+    setenv("BYTEPS_SERVER_ENGINE_THREAD", args["engine_threads"].c_str(), 1);
+    args.erase("engine_threads");
+  }
+  for (auto& arg : args) {
+    fprintf(stderr, "unknown option --%s\n", arg.first.c_str());
+    exit(1);
+  }
+  if (!opts.workers || !opts.keys || !opts.size || !opts.rounds) {
+    fprintf(stderr, "workers, keys, size and rounds should be positive\n");
+    exit(1);
+  }
+  if (opts.row_sparse && (!opts.compressor.empty() ||
+                          opts.dtype == common::BYTEPS_FLOAT16)) {
+    fprintf(stderr, "row-sparse keys are not compressed or float16\n");
+    exit(1);
+  }
+  return opts;
+}
+
+}  // namespace
+
+int RunBenchmark(int argc, char** argv) {
+  auto opts = ParseOptions(argc, argv);
+
+  local_num_workers_ = opts.workers;
+  std::vector<std::unique_ptr<Worker>> workers;
+  response_sink_ = [&workers](const ps::KVMeta& req,
+                              const ps::KVPairs<char>& res) {
+    workers[Worker::Rank(req.sender)]->OnResponse(req, res);
+  };
+  StartEngine();
+
+  Clock::time_point start, end;
+  {
+    Dispatcher dispatcher;
+    Barrier barrier(opts.workers);
+    for (size_t i = 0; i < opts.workers; ++i) {
+      workers.emplace_back(new Worker(opts, i, &dispatcher));
+    }
+    std::vector<std::thread> threads;
+    for (auto& w : workers) {
+      threads.emplace_back(&Worker::Run, w.get(), &barrier, &start, &end);
+    }
+    for (auto& t : threads) t.join();
+  }
+  StopEngine();
+
+  Latency latency;
+  size_t errors = 0;
+  for (auto& w : workers) {
+    auto& l = w->latency();
+    latency.push_us.insert(latency.push_us.end(), l.push_us.begin(),
+                           l.push_us.end());
+    latency.pull_us.insert(latency.pull_us.end(), l.pull_us.begin(),
+                           l.pull_us.end());
+    latency.round_us.insert(latency.round_us.end(), l.round_us.begin(),
+                            l.round_us.end());
+    errors += w->errors();
+  }
+
+  double sec = std::chrono::duration<double>(end - start).count();
+  double key_rounds = double(opts.keys) * opts.rounds;
+  double bytes = key_rounds * opts.workers * opts.size;
+  auto engine_threads = getenv("BYTEPS_SERVER_ENGINE_THREAD");
+  printf("workers %zu, keys %zu, size %zu, dtype %s, compressor %s, "
+         "row_sparse %zu, engine threads %s\n",
+         opts.workers, opts.keys, opts.size,
+         opts.dtype == common::BYTEPS_FLOAT16 ? "float16" : "float32",
+         opts.compressor.empty() ? "none" : opts.compressor.c_str(),
+         opts.row_sparse, engine_threads ? engine_threads : "4");
+  printf("%zu rounds in %.3f s: %.1f keys/s, %.3f GB/s summed\n", opts.rounds,
+         sec, key_rounds / sec, bytes / sec / 1e9);
+  PrintLatency("push", latency.push_us);
+  PrintLatency("pull", latency.pull_us);
+  PrintLatency("round", latency.round_us);
+  if (errors) {
+    fprintf(stderr, "%zu pulled results are wrong\n", errors);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace server
+}  // namespace byteps
+
+int main(int argc, char** argv) {
+  return byteps::server::RunBenchmark(argc, argv);
+}
@@ -0,0 +1,106 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 << 20;
+
+size_t RoundUpTo(size_t x, size_t align) {
+  return (x + align - 1) / align * align;
+}
+
+}  // namespace
+
+BufferPool::BufferPool(size_t arena_size)
+    : _arena_size(RoundUpTo(arena_size, kHugePageSize)) {
+  CHECK_GT(_arena_size, 0);
+  AddArena(_arena_size);
+}
+
+BufferPool::~BufferPool() {
+  for (auto& arena : _arenas) munmap(arena.base, arena.size);
+}
+
+void BufferPool::AddArena(size_t size) {
+  size = RoundUpTo(std::max(size, _arena_size), kHugePageSize);
+  Arena arena = {nullptr, size, true};
+  // explicit huge pages are only available if reserved, e.g., through
+  // /proc/sys/vm/nr_hugepages
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1,
+                0);
+  if (p == MAP_FAILED) {
+    arena.hugetlb = false;
+    // over-allocate to align the arena to huge pages
+    auto raw = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(raw != MAP_FAILED) << "failed to map a buffer arena of " << size
+                             << " bytes: " << strerror(errno);
+    auto begin = reinterpret_cast<uintptr_t>(raw);
+    auto aligned = RoundUpTo(begin, kHugePageSize);
+    if (aligned > begin) munmap(raw, aligned - begin);
+    munmap(reinterpret_cast<char*>(aligned) + size,
+           begin + kHugePageSize - aligned);
+    p = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    if (madvise(p, size, MADV_HUGEPAGE)) {
+      LOG(WARNING) << "transparent huge pages are not available for buffer "
+                      "arenas: "
+                   << strerror(errno);
+    }
+#endif
+    // fault in the pages now instead of during the first rounds
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page_size) {
+      static_cast<volatile char*>(p)[i] = 0;
+    }
+  }
+  arena.base = static_cast<char*>(p);
+  _arenas.push_back(arena);
+  _offset = 0;
+  LOG(INFO) << "BytePS server mapped a buffer arena of " << size << " bytes"
+            << (arena.hugetlb ? " on explicit huge pages" : "");
+}
+
+void* BufferPool::Alloc(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size = RoundUpTo(std::max<size_t>(size, 1), page_size);
+  std::lock_guard<std::mutex> lock(_mu);
+  if (_offset + size > _arenas.back().size) {
+    // the rest of the last arena is left unused
+    AddArena(size);
+  }
+  auto p = _arenas.back().base + _offset;
+  _offset += size;
+  // arenas are zeroed when mapped, and buffers are never reused
+  return p;
+}
+
+}  // namespace server
+}  // namespace byteps
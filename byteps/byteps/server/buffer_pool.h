@@ -0,0 +1,66 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_BUFFER_POOL_H
+#define BYTEPS_SERVER_BUFFER_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace byteps {
+namespace server {
+
+/**
+ * \brief pool of server buffers carved out of large arenas
+ *
+ * Arenas are backed by huge pages if possible, i.e., explicit huge pages if
+ * some are reserved, or transparent huge pages otherwise, and are faulted in
+ * when mapped. Buffers are never returned to the pool: the server keeps the
+ * buffers of a key until it exits, and all arenas are unmapped when the pool
+ * is destroyed.
+ */
+class BufferPool {
+ public:
+  /**
+   * \param arena_size bytes of each arena. the first one is mapped at once.
+   */
+  explicit BufferPool(size_t arena_size);
+  ~BufferPool();
+
+  /*! \brief allocate a zeroed, page aligned buffer */
+  void* Alloc(size_t size);
+
+ private:
+  struct Arena {
+    char* base;
+    size_t size;
+    bool hugetlb;
+  };
+
+  /*! \brief map and pre-fault an arena of at least size bytes */
+  void AddArena(size_t size);
+
+  size_t _arena_size;
+  std::mutex _mu;
+  std::vector<Arena> _arenas;
+  // offset of the free space in the last arena
+  size_t _offset = 0;
+};
+
+}  // namespace server
+}  // namespace byteps
+
+#endif  // BYTEPS_SERVER_BUFFER_POOL_H
@@ -0,0 +1,144 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_KEY_TABLE_H
+#define BYTEPS_SERVER_KEY_TABLE_H
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+/**
+ * \brief table of per-key slots with lock-free lookups
+ *
+ * Keys are remapped to dense slot ids through an open-addressing index that
+ * is allocated once. Slots are allocated in chunks of cache-line aligned
+ * memory and never move, so pointers to them stay valid. Only the insertion
+ * of a new key takes a lock.
+ */
+template <typename T>
+class KeyTable {
+ public:
+  explicit KeyTable(size_t capacity) : capacity_(capacity) {
+    CHECK_GT(capacity_, 0);
+    size_t n = 1;
+    while (n < 2 * capacity_) n <<= 1;
+    mask_ = n - 1;
+    index_.reset(new Entry[n]);
+    for (size_t i = 0; i < n; ++i) {
+      index_[i].key.store(kEmptyKey, std::memory_order_relaxed);
+    }
+    num_chunks_ = (capacity_ + kChunkSize - 1) / kChunkSize;
+    chunks_.reset(new T*[num_chunks_]());
+  }
+
+  ~KeyTable() {
+    for (size_t i = 0; i < size(); ++i) At(i)->~T();
+    for (size_t i = 0; i < num_chunks_; ++i) free(chunks_[i]);
+  }
+
+  /**
+   * \brief find the slot of a key. lock-free.
+   * \return nullptr if the key has not been inserted
+   */
+  T* Find(uint64_t key) const {
+    for (size_t i = Hash(key);; i = (i + 1) & mask_) {
+      auto k = index_[i].key.load(std::memory_order_acquire);
+      if (k == key) return At(index_[i].slot);
+      if (k == kEmptyKey) return nullptr;
+    }
+  }
+
+  /**
+   * \brief find the slot of a key, inserting it if needed. threadsafe.
+   */
+  T* Get(uint64_t key) {
+    auto slot = Find(key);
+    if (slot) return slot;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    size_t i = Hash(key);
+    for (;; i = (i + 1) & mask_) {
+      auto k = index_[i].key.load(std::memory_order_relaxed);
+      if (k == key) return At(index_[i].slot);
+      if (k == kEmptyKey) break;
+    }
+    auto id = size_.load(std::memory_order_relaxed);
+    CHECK_LT(id, capacity_) << "key table is full (capacity=" << capacity_
+                            << ")";
+    auto& chunk = chunks_[id / kChunkSize];
+    if (!chunk) {
+      void* p;
+      int ret = posix_memalign(&p, kCacheLineSize, kChunkSize * sizeof(T));
+      CHECK_EQ(ret, 0) << "posix_memalign error: " << strerror(ret);
+      chunk = static_cast<T*>(p);
+    }
+    new (chunk + id % kChunkSize) T();
+    index_[i].slot = id;
+    // publish the key only after the slot is ready
+    index_[i].key.store(key, std::memory_order_release);
+    size_.store(id + 1, std::memory_order_release);
+    return At(id);
+  }
+
+  /**
+   * \brief apply func to every inserted slot. threadsafe, slots inserted
+   * concurrently may be skipped.
+   */
+  template <typename F>
+  void ForEach(F&& func) {
+    auto n = size();
+    for (size_t i = 0; i < n; ++i) func(At(i));
+  }
+
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+
+ private:
+  static constexpr uint64_t kEmptyKey = ~0ULL;
+  static constexpr size_t kChunkSize = 1024;
+  static constexpr size_t kCacheLineSize = 64;
+
+  struct Entry {
+    std::atomic<uint64_t> key;
+    size_t slot;
+  };
+
+  size_t Hash(uint64_t key) const {
+    // fibonacci hashing, keys are (tensor id << 16) + partition id
+    return (key * 0x9E3779B97F4A7C15ULL >> 32) & mask_;
+  }
+
+  T* At(size_t id) const { return chunks_[id / kChunkSize] + id % kChunkSize; }
+
+  size_t capacity_;
+  size_t mask_;
+  size_t num_chunks_;
+  std::unique_ptr<Entry[]> index_;
+  std::unique_ptr<T*[]> chunks_;
+  std::atomic<size_t> size_{0};
+  std::mutex mu_;
+};
+
+}  // namespace server
+}  // namespace byteps
+
+#endif  // BYTEPS_SERVER_KEY_TABLE_H
@@ -0,0 +1,189 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "optimizer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+Optimizer::Optimizer(const OptimizerParams& params, size_t num_elem,
+                     Snapshot* snapshot, uint64_t key)
+    : _params(params),
+      _num_elem(num_elem),
+      _snapshot(snapshot),
+      _key(key),
+      _t(InitSteps()) {
+  _weight = Alloc();
+  // a server may have died between saving the step count and the weights
+  if (!_restored) _t = 0;
+}
+
+Optimizer::~Optimizer() {
+  for (auto buf : _buffers) free(buf);
+}
+
+uint64_t& Optimizer::InitSteps() {
+  if (!_snapshot) return _own_steps;
+  auto p = _snapshot->Acquire(_key, kSnapshotOptimizerSteps, sizeof(uint64_t),
+                              &_restored);
+  return *static_cast<uint64_t*>(p);
+}
+
+float* Optimizer::Alloc() {
+  auto index = _num_buffers++;
+  if (_snapshot) {
+    bool restored;
+    auto p = _snapshot->Acquire(_key, kSnapshotOptimizerBuffer + index,
+                                _num_elem * sizeof(float), &restored);
+    // the first buffer holds the weights
+    if (index == 0) _restored = _restored && restored;
+    return static_cast<float*>(p);
+  }
+  void* p;
+  int ret = posix_memalign(&p, 64, _num_elem * sizeof(float));
+  CHECK_EQ(ret, 0) << "posix_memalign error: " << strerror(ret);
+  memset(p, 0, _num_elem * sizeof(float));
+  _buffers.push_back(static_cast<float*>(p));
+  return static_cast<float*>(p);
+}
+
+void Optimizer::Init(const float* data, float scale) {
+  float* __restrict__ w = _weight;
+#pragma omp simd
+  for (size_t i = 0; i < _num_elem; ++i) {
+    w[i] = data[i] * scale;
+  }
+}
+
+SGD::SGD(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+         uint64_t key)
+    : Optimizer(params, num_elem, snapshot, key) {
+  if (_params.momentum != 0) _mom = Alloc();
+}
+
+void SGD::Step(const float* __restrict__ grad) {
+  float* __restrict__ w = _weight;
+  const float lr = _params.lr;
+  const float wd = _params.weight_decay;
+  const float mu = _params.momentum;
+  if (_mom) {
+    float* __restrict__ m = _mom;
+#pragma omp simd
+    for (size_t i = 0; i < _num_elem; ++i) {
+      m[i] = mu * m[i] + grad[i] + wd * w[i];
+      w[i] -= lr * m[i];
+    }
+  } else {
+#pragma omp simd
+    for (size_t i = 0; i < _num_elem; ++i) {
+      w[i] -= lr * (grad[i] + wd * w[i]);
+    }
+  }
+  ++_t;
+}
+
+Adam::Adam(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+           uint64_t key)
+    : Optimizer(params, num_elem, snapshot, key) {
+  _m = Alloc();
+  _v = Alloc();
+}
+
+void Adam::Step(const float* __restrict__ grad) {
+  ++_t;
+  float* __restrict__ w = _weight;
+  float* __restrict__ m = _m;
+  float* __restrict__ v = _v;
+  const float lr = _params.lr;
+  const float wd = _params.weight_decay;
+  const float b1 = _params.beta1;
+  const float b2 = _params.beta2;
+  const float eps = _params.eps;
+  // bias corrections
+  const float c1 = 1.0f / (1.0f - std::pow(b1, static_cast<float>(_t)));
+  const float c2 = 1.0f / (1.0f - std::pow(b2, static_cast<float>(_t)));
+#pragma omp simd
+  for (size_t i = 0; i < _num_elem; ++i) {
+    m[i] = b1 * m[i] + (1 - b1) * grad[i];
+    v[i] = b2 * v[i] + (1 - b2) * grad[i] * grad[i];
+    w[i] -= lr * (m[i] * c1 / (std::sqrt(v[i] * c2) + eps) + wd * w[i]);
+  }
+}
+
+LAMB::LAMB(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+           uint64_t key)
+    : Optimizer(params, num_elem, snapshot, key) {
+  _m = Alloc();
+  _v = Alloc();
+  _update = Alloc();
+}
+
+void LAMB::Step(const float* __restrict__ grad) {
+  ++_t;
+  float* __restrict__ w = _weight;
+  float* __restrict__ m = _m;
+  float* __restrict__ v = _v;
+  float* __restrict__ u = _update;
+  const float wd = _params.weight_decay;
+  const float b1 = _params.beta1;
+  const float b2 = _params.beta2;
+  const float eps = _params.eps;
+  const float c1 = 1.0f / (1.0f - std::pow(b1, static_cast<float>(_t)));
+  const float c2 = 1.0f / (1.0f - std::pow(b2, static_cast<float>(_t)));
+  double w_norm = 0, u_norm = 0;
+#pragma omp simd reduction(+ : w_norm, u_norm)
+  for (size_t i = 0; i < _num_elem; ++i) {
+    m[i] = b1 * m[i] + (1 - b1) * grad[i];
+    v[i] = b2 * v[i] + (1 - b2) * grad[i] * grad[i];
+    u[i] = m[i] * c1 / (std::sqrt(v[i] * c2) + eps) + wd * w[i];
+    w_norm += w[i] * w[i];
+    u_norm += u[i] * u[i];
+  }
+  float ratio = 1;
+  if (w_norm > 0 && u_norm > 0) {
+    ratio = static_cast<float>(std::sqrt(w_norm / u_norm));
+  }
+  const float step = _params.lr * ratio;
+#pragma omp simd
+  for (size_t i = 0; i < _num_elem; ++i) {
+    w[i] -= step * u[i];
+  }
+}
+
+std::unique_ptr<Optimizer> CreateOptimizer(const OptimizerParams& params,
+                                           size_t num_elem, Snapshot* snapshot,
+                                           uint64_t key) {
+  if (params.type == "sgd") {
+    return std::unique_ptr<Optimizer>(
+        new SGD(params, num_elem, snapshot, key));
+  } else if (params.type == "adam") {
+    return std::unique_ptr<Optimizer>(
+        new Adam(params, num_elem, snapshot, key));
+  } else if (params.type == "lamb") {
+    return std::unique_ptr<Optimizer>(
+        new LAMB(params, num_elem, snapshot, key));
+  }
+  LOG(FATAL) << "unknown server optimizer: " << params.type;
+  return nullptr;
+}
+
+}  // namespace server
+}  // namespace byteps
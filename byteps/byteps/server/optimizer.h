@@ -0,0 +1,156 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_OPTIMIZER_H
+#define BYTEPS_SERVER_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "snapshot.h"
+
+namespace byteps {
+namespace server {
+
+/**
+ * \brief hyper-parameters of the optimizer running on servers
+ */
+struct OptimizerParams {
+  // sgd, adam or lamb
+  std::string type;
+  float lr = 0.01;
+  // momentum of sgd
+  float momentum = 0;
+  float beta1 = 0.9;
+  float beta2 = 0.999;
+  float eps = 1e-8;
+  float weight_decay = 0;
+};
+
+/**
+ * \brief optimizer updating the fp32 master weights of a key on servers
+ *
+ * It owns the master weights and the optimizer states of the key. Step is
+ * called by the engine thread of the key once the gradients of a round are
+ * summed, so it needs no synchronization.
+ *
+ * With a snapshot, the buffers and the step count are kept in it, so that a
+ * restarted server resumes with them.
+ */
+class Optimizer {
+ public:
+  Optimizer(const OptimizerParams& params, size_t num_elem,
+            Snapshot* snapshot = nullptr, uint64_t key = 0);
+  virtual ~Optimizer();
+
+  /**
+   * \brief initialize the master weights with data * scale
+   */
+  void Init(const float* data, float scale);
+
+  /**
+   * \brief update the master weights with the summed gradients
+   */
+  virtual void Step(const float* grad) = 0;
+
+  const float* weight() const { return _weight; }
+
+  size_t num_elem() const { return _num_elem; }
+
+  /*! \brief whether the weights are restored from the snapshot */
+  bool restored() const { return _restored; }
+
+ protected:
+  /*! \brief allocate a zeroed buffer of num_elem floats */
+  float* Alloc();
+
+  OptimizerParams _params;
+  size_t _num_elem;
+
+ private:
+  uint64_t& InitSteps();
+
+  Snapshot* _snapshot;
+  uint64_t _key;
+  bool _restored = false;
+  uint64_t _own_steps = 0;
+  // buffers allocated on the heap
+  std::vector<float*> _buffers;
+  size_t _num_buffers = 0;
+
+ protected:
+  // number of steps taken
+  uint64_t& _t;
+  float* _weight;
+};
+
+/**
+ * \brief sgd with optional momentum and weight decay
+ */
+class SGD : public Optimizer {
+ public:
+  SGD(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+      uint64_t key);
+  void Step(const float* grad) override;
+
+ private:
+  float* _mom = nullptr;
+};
+
+/**
+ * \brief adam with decoupled weight decay (i.e., adamw)
+ */
+class Adam : public Optimizer {
+ public:
+  Adam(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+       uint64_t key);
+  void Step(const float* grad) override;
+
+ private:
+  float* _m;
+  float* _v;
+};
+
+/**
+ * \brief lamb, with the trust ratio computed per key
+ */
+class LAMB : public Optimizer {
+ public:
+  LAMB(const OptimizerParams& params, size_t num_elem, Snapshot* snapshot,
+       uint64_t key);
+  void Step(const float* grad) override;
+
+ private:
+  float* _m;
+  float* _v;
+  float* _update;
+};
+
+/**
+ * \brief create the optimizer of params.type for a key, keeping its states
+ *        in the snapshot if not null
+ */
+std::unique_ptr<Optimizer> CreateOptimizer(const OptimizerParams& params,
+                                           size_t num_elem,
+                                           Snapshot* snapshot = nullptr,
+                                           uint64_t key = 0);
+
+}  // namespace server
+}  // namespace byteps
+
+#endif  // BYTEPS_SERVER_OPTIMIZER_H
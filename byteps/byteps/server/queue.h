@@ -16,92 +16,345 @@
 #ifndef BYTEPS_SERVER_QUEUE_H
 #define BYTEPS_SERVER_QUEUE_H
 
-#include <vector>
-#include <mutex>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
-#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace byteps {
 namespace server {
 
 /**
- * \brief thread-safe queue allowing push and waited pop
+ * \brief interface of the queue feeding an engine thread
  */
-class PriorityQueue {
+class EngineQueue {
  public:
-  PriorityQueue(bool is_schedule) {
-    enable_schedule_ = is_schedule;
-    if (enable_schedule_) {
-      std::make_heap(queue_.begin(), queue_.end(),
-        [this](const BytePSEngineMessage& a, const BytePSEngineMessage& b) {
-          return ComparePriority(a, b);
-        }
-      );
+  virtual ~EngineQueue() {}
+
+  /**
+   * \brief push a value. threadsafe.
+   * \param new_value the value
+   */
+  virtual void Push(BytePSEngineMessage new_value) = 0;
+
+  /**
+   * \brief push a value if the queue is not full. threadsafe.
+   * \param new_value the value, left untouched if it is not pushed
+   * \return whether the value is pushed
+   */
+  virtual bool TryPush(BytePSEngineMessage&& new_value) = 0;
+
+  /**
+   * \brief wait until pop an element. only one consumer is allowed.
+   * \param value the poped value
+   */
+  virtual void WaitAndPop(BytePSEngineMessage* value) = 0;
+
+  /**
+   * \brief pop an element if there is one. only one consumer is allowed.
+   * \param value the poped value
+   * \return whether an element is poped
+   */
+  virtual bool TryPop(BytePSEngineMessage* value) = 0;
+
+  virtual void ClearCounter(uint64_t key) {}
+};
+
+/**
+ * \brief bounded lock-free multi-producer single-consumer FIFO queue
+ *
+ * Producers claim a cell with a CAS on the tail and publish it through the
+ * cell's sequence number. The consumer spins briefly when the queue is empty,
+ * then parks on a futex. Producers only issue a wake-up syscall when the
+ * consumer is parked. When the queue is full, Push yields until the consumer
+ * frees a cell, while TryPush returns at once.
+ */
+template <typename T>
+class MPSCRing {
+ public:
+  explicit MPSCRing(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    mask_ = cap - 1;
+    cells_.reset(new Cell[cap]);
+    for (size_t i = 0; i < cap; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
     }
   }
-  ~PriorityQueue() { }
+  ~MPSCRing() {}
 
   /**
-   * \brief push an value and sort using heap. threadsafe.
+   * \brief push a value, wait while the queue is full. threadsafe.
    * \param new_value the value
    */
-  void Push(BytePSEngineMessage new_value) {
-    mu_.lock();
-    queue_.push_back(std::move(new_value));
-    if (enable_schedule_) {
-      ++push_cnt_[new_value.key];
-      std::push_heap(queue_.begin(), queue_.end(),
-        [this](const BytePSEngineMessage& a, const BytePSEngineMessage& b) {
-          return ComparePriority(a, b);
+  void Push(T new_value) {
+    while (!TryPush(std::move(new_value))) {
+      // full, wait for the consumer
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * \brief push a value if the queue is not full. threadsafe.
+   * \param new_value the value, left untouched if it is not pushed
+   * \return whether the value is pushed
+   */
+  bool TryPush(T&& new_value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
         }
-      );
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->msg = std::move(new_value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    // pairs with the fence in WaitAndPop
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) {
+      futex_.fetch_add(1, std::memory_order_release);
+      syscall(SYS_futex, &futex_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
     }
-    mu_.unlock();
-    cond_.notify_all();
+    return true;
   }
 
   /**
-   * \brief wait until pop an element from the beginning, threadsafe
+   * \brief wait until pop an element. only one consumer is allowed.
    * \param value the poped value
    */
-  void WaitAndPop(BytePSEngineMessage* value) {
-    std::unique_lock<std::mutex> lk(mu_);
-    cond_.wait(lk, [this]{return !queue_.empty();});
-    if (enable_schedule_) {
-      std::pop_heap(queue_.begin(), queue_.end(),
-        [this](const BytePSEngineMessage& a, const BytePSEngineMessage& b) {
-          return ComparePriority(a, b);
-        }
-      );
-      *value = queue_.back();
-      queue_.pop_back();
-    } else {
-      *value = std::move(queue_.front());
-      queue_.erase(queue_.begin());
+  void WaitAndPop(T* value) {
+    int spin = 0;
+    while (!TryPop(value)) {
+      if (++spin < kSpinCount) continue;
+      uint32_t epoch = futex_.load(std::memory_order_acquire);
+      parked_.store(true, std::memory_order_relaxed);
+      // pairs with the fence in Push
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!IsEmpty()) {
+        parked_.store(false, std::memory_order_relaxed);
+        continue;
+      }
+      syscall(SYS_futex, &futex_, FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr,
+              0);
+      parked_.store(false, std::memory_order_relaxed);
+      spin = 0;
+    }
+  }
+
+  /**
+   * \brief pop an element if there is one. only one consumer is allowed.
+   * \param value the poped value
+   */
+  bool TryPop(T* value) {
+    auto& cell = cells_[head_ & mask_];
+    if (cell.seq.load(std::memory_order_acquire) != head_ + 1) return false;
+    *value = std::move(cell.msg);
+    // drop the references to the received buffers
+    cell.msg = T();
+    cell.seq.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T msg;
+  };
+
+  bool IsEmpty() {
+    auto& cell = cells_[head_ & mask_];
+    return cell.seq.load(std::memory_order_acquire) != head_ + 1;
+  }
+
+  static constexpr int kSpinCount = 128;
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  // keep producers and the consumer on different cache lines
+  char pad0_[64];
+  std::atomic<size_t> tail_{0};
+  char pad1_[64];
+  size_t head_ = 0;
+  std::atomic<bool> parked_{false};
+  std::atomic<uint32_t> futex_{0};
+};
+
+/**
+ * \brief lock-free FIFO queue feeding an engine thread
+ */
+class MPSCQueue : public EngineQueue {
+ public:
+  explicit MPSCQueue(size_t capacity) : ring_(capacity) {}
+  ~MPSCQueue() override {}
+
+  void Push(BytePSEngineMessage new_value) override {
+    ring_.Push(std::move(new_value));
+  }
+
+  bool TryPush(BytePSEngineMessage&& new_value) override {
+    return ring_.TryPush(std::move(new_value));
+  }
+
+  void WaitAndPop(BytePSEngineMessage* value) override {
+    ring_.WaitAndPop(value);
+  }
+
+  bool TryPop(BytePSEngineMessage* value) override {
+    return ring_.TryPop(value);
+  }
+
+ private:
+  MPSCRing<BytePSEngineMessage> ring_;
+};
+
+/**
+ * \brief thread-safe priority queue allowing push and waited pop
+ *
+ * Keys with fewer pushes go first, and messages of the same priority are
+ * served in arrival order. Messages are kept in a FIFO per key, and a heap
+ * indexed by key orders the keys, so a key is re-positioned in O(log n) when
+ * its push counter changes.
+ */
+class PriorityQueue : public EngineQueue {
+ public:
+  PriorityQueue() {}
+  ~PriorityQueue() override {}
+
+  void Push(BytePSEngineMessage new_value) override {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      auto& entry = entries_[new_value.key];
+      ++entry.push_cnt;
+      entry.msgs.push_back(std::move(new_value));
+      if (entry.pos < 0) {
+        entry.pos = heap_.size();
+        heap_.push_back(&entry);
+        SiftUp(entry.pos);
+      } else {
+        // higher counter means lower priority
+        SiftDown(entry.pos);
+      }
     }
+    cond_.notify_one();
+  }
+
+  // unbounded
+  bool TryPush(BytePSEngineMessage&& new_value) override {
+    Push(std::move(new_value));
+    return true;
   }
 
-  void ClearCounter(uint64_t key) {
-    if (!enable_schedule_) return;
+  void WaitAndPop(BytePSEngineMessage* value) override {
     std::unique_lock<std::mutex> lk(mu_);
-    push_cnt_[key] = 0;
+    cond_.wait(lk, [this] { return !heap_.empty(); });
+    PopTop(value);
+  }
+
+  bool TryPop(BytePSEngineMessage* value) override {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (heap_.empty()) return false;
+    PopTop(value);
+    return true;
+  }
+
+  void ClearCounter(uint64_t key) override {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto& entry = entries_[key];
+    entry.push_cnt = 0;
+    if (entry.pos >= 0) SiftUp(entry.pos);
   }
 
-  bool ComparePriority(const BytePSEngineMessage& a, const BytePSEngineMessage& b) {
-    if (push_cnt_[a.key] == push_cnt_[b.key]) {
-      return (a.id > b.id);
+ private:
+  struct KeyEntry {
+    std::deque<BytePSEngineMessage> msgs;
+    uint64_t push_cnt = 0;
+    int pos = -1;  // position in heap_, -1 if not in heap_
+  };
+
+  // pop the first message of the top key, with mu_ held
+  void PopTop(BytePSEngineMessage* value) {
+    auto entry = heap_.front();
+    *value = std::move(entry->msgs.front());
+    entry->msgs.pop_front();
+    if (entry->msgs.empty()) {
+      RemoveTop();
     } else {
-      return (push_cnt_[a.key] > push_cnt_[b.key]);
+      SiftDown(0);
     }
   }
 
- private:
+  // whether a should be served before b
+  static bool Before(const KeyEntry* a, const KeyEntry* b) {
+    if (a->push_cnt == b->push_cnt) {
+      return a->msgs.front().id < b->msgs.front().id;
+    }
+    return a->push_cnt < b->push_cnt;
+  }
+
+  void Swap(int i, int j) {
+    std::swap(heap_[i], heap_[j]);
+    heap_[i]->pos = i;
+    heap_[j]->pos = j;
+  }
+
+  void SiftUp(int i) {
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (!Before(heap_[i], heap_[parent])) break;
+      Swap(i, parent);
+      i = parent;
+    }
+  }
+
+  void SiftDown(int i) {
+    int n = heap_.size();
+    while (true) {
+      int best = i;
+      int l = 2 * i + 1, r = 2 * i + 2;
+      if (l < n && Before(heap_[l], heap_[best])) best = l;
+      if (r < n && Before(heap_[r], heap_[best])) best = r;
+      if (best == i) break;
+      Swap(i, best);
+      i = best;
+    }
+  }
+
+  void RemoveTop() {
+    heap_.front()->pos = -1;
+    int last = heap_.size() - 1;
+    if (last > 0) {
+      heap_[0] = heap_[last];
+      heap_[0]->pos = 0;
+    }
+    heap_.pop_back();
+    if (!heap_.empty()) SiftDown(0);
+  }
+
   mutable std::mutex mu_;
-  std::vector<BytePSEngineMessage> queue_;
   std::condition_variable cond_;
-  std::unordered_map<uint64_t, uint64_t> push_cnt_;
-  volatile bool enable_schedule_ = false;
+  std::unordered_map<uint64_t, KeyEntry> entries_;
+  std::vector<KeyEntry*> heap_;
 };
 
 }  // namespace server
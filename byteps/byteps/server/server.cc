@@ -15,7 +15,9 @@
 
 #include "server.h"
 
+#include "../common/compressor/header.h"
 #include "../common/compressor/utils.h"
+#include "../common/row_sparse.h"
 #include "queue.h"
 
 namespace byteps {
@@ -24,105 +26,349 @@ namespace server {
 using namespace ps;
 
 // engine related
-std::vector<PriorityQueue*> engine_queues_;
+std::vector<EngineQueue*> engine_queues_;
 std::vector<std::thread*> engine_threads_;
+// compression related
+std::vector<EngineQueue*> compress_queues_;
+std::vector<std::thread*> compress_threads_;
+// handler related
+std::vector<std::unique_ptr<MPSCRing<BytePSHandleMessage>>> handler_queues_;
+std::vector<std::thread*> handler_threads_;
+// rebalance related
+std::thread* rebalance_thread_ = nullptr;
+std::mutex rebalance_mu_;
+std::condition_variable rebalance_cv_;
+bool rebalance_stop_ = false;
 float lb_factor_ = 1;
 
-BytePSArray* GetStore(uint64_t key) {
-  std::lock_guard<std::mutex> lock(store_mu_);
-  return &store_[key];
-}
+BytePSArray* GetStore(uint64_t key) { return &GetSlot(key)->store; }
 
-UpdateBuf* GetUpdate(uint64_t key) {
-  std::lock_guard<std::mutex> lock(update_mu_);
-  return &update_buf_[key];
-}
+UpdateBuf* GetUpdate(uint64_t key) { return &GetSlot(key)->update; }
 
-BytePSArray* GetFP16Copy(uint64_t key) {
-  std::lock_guard<std::mutex> lock(fp16_mu_);
-  return &fp16_copy_[key];
+BytePSArray* GetFP16Copy(uint64_t key) { return &GetSlot(key)->fp16_copy; }
+
+void Respond(const ps::KVMeta& req, const ps::KVPairs<char>& res,
+             ps::KVServer<char>* server) {
+  if (response_sink_) return response_sink_(req, res);
+  server->Response(req, res);
 }
 
 void SendPushResponse(uint64_t key, const ps::KVMeta& req,
                       ps::KVServer<char>* server) {
-  auto iterator = push_response_map_.find(key);
-  if (iterator == push_response_map_.end()) {  // new key
-    ps::KVPairs<char> response;
-    push_response_map_[key] = response;  // add to the map
-    server->Response(req, response);
-  } else {  // not new key, then reuse the memory address to avoid ibv_reg_mr on
-            // RDMA data path
-    ps::KVPairs<char>* response = &iterator->second;
-    server->Response(req, *response);
-  }
+  // reuse the memory address to avoid ibv_reg_mr on RDMA data path
+  Respond(req, GetSlot(key)->push_response, server);
 }
 
 void SendPullResponse(const DataHandleType type, const uint64_t key,
                       const ps::KVMeta& req_meta, ps::KVServer<char>* server) {
-  std::lock_guard<std::mutex> lock(pullresp_mu_);
-  auto& updates = update_buf_[key];
+  auto slot = GetSlot(key);
+  auto& updates = slot->update;
   CHECK(updates.merged.tensor) << "init " << key << " first";
   char* data = updates.merged.tensor;
   auto len = updates.merged.len;
 
   // send pull response
-  auto iterator = pull_response_map_.find(key);
-  if (iterator == pull_response_map_.end()) {  // new key
-    ps::KVPairs<char> response;
-    response.keys = {EncodeKey(key)};
-    response.lens = {len};
-    response.vals = ps::SArray<char>(data, len, false);  // zero copy
-    pull_response_map_[key] = response;                  // add to the map
-    server->Response(req_meta, response);
+  auto start_ns = telemetry_ ? NowNs() : 0;
+  auto response = &slot->pull_response;
+  if (response->keys.empty()) {  // new key
+    response->keys = {EncodeKey(key)};
+    response->lens = {len};
+    response->vals = ps::SArray<char>(data, len, false);  // zero copy
+    Respond(req_meta, *response, server);
   } else {  // not new key, then reuse the memory address to avoid ibv_reg_mr on
             // RDMA data path
-    ps::KVPairs<char>* response = &iterator->second;
-
     auto p = static_cast<char*>(data);
     CHECK(p);
     response->lens = {len};
     response->vals = ps::SArray<char>(p, len, false);
-    server->Response(req_meta, *response);
+    Respond(req_meta, *response, server);
+  }
+  if (telemetry_) {
+    telemetry_->Record(kPullSend, NowNs() - start_ns, &slot->stats);
+  }
+}
+
+// split a large key into stripes summed by several engine threads, so that
+// it does not serialize on a single core. the stripe i of every push goes to
+// the same thread, which keeps the order of COPY_FIRST/SUM_FIRST and SUM_RECV.
+void PushStripes(size_t tid, const BytePSEngineMessage& msg) {
+  auto slot = GetSlot(msg.key);
+  size_t num_stripes = DivUp(msg.len, stripe_size_);
+  slot->stripe_pending.fetch_add(num_stripes, std::memory_order_relaxed);
+  for (size_t i = 0; i < num_stripes; ++i) {
+    size_t offset = i * stripe_size_;
+    BytePSEngineMessage stripe = msg;
+    stripe.dst = reinterpret_cast<char*>(msg.dst) + offset;
+    stripe.src = reinterpret_cast<char*>(msg.src) + offset;
+    if (msg.src2) stripe.src2 = reinterpret_cast<char*>(msg.src2) + offset;
+    stripe.len = std::min(stripe_size_, msg.len - offset);
+    stripe.striped = true;
+    engine_queues_[(tid + i) % engine_thread_num_]->Push(stripe);
+  }
+}
+
+// messages an engine thread could not push to the full queue of another
+// one. engine threads never wait for each other, as two of them may push to
+// the full queue of the other at the same time.
+using EngineBacklog = std::deque<std::pair<EngineQueue*, BytePSEngineMessage>>;
+
+// push the backlog of an engine thread in order, as far as the queues take it
+void DrainBacklog(EngineBacklog* backlog) {
+  while (!backlog->empty()) {
+    auto& front = backlog->front();
+    if (!front.first->TryPush(std::move(front.second))) break;
+    backlog->pop_front();
+  }
+}
+
+// called when a stripe is summed, or when all pushes of the round arrived.
+// engine threads pass their backlog, handler threads wait if the queue is full.
+void FinishStripe(uint64_t key, EngineBacklog* backlog = nullptr) {
+  auto slot = GetSlot(key);
+  if (slot->stripe_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    auto q = engine_queues_[slot->tid.load(std::memory_order_acquire)];
+    BytePSEngineMessage msg = slot->all_recv;
+    if (!backlog) {
+      q->Push(std::move(msg));
+    } else if (!backlog->empty() || !q->TryPush(std::move(msg))) {
+      // behind the backlog, to keep the order of the pushes
+      backlog->emplace_back(q, std::move(msg));
+    }
+  }
+}
+
+// sum a push of a row-sparse key into the store. the store is zeroed by the
+// first push of a round, so that the rows pushed by nobody stay zero.
+void SumRowSparse(KeySlot* slot, const BytePSEngineMessage& msg, bool first) {
+  auto store = reinterpret_cast<char*>(msg.dst);
+  size_t len = slot->store.len;
+  auto bps_type = bps_reducer_->GetDataType(msg.type.dtype);
+  if (first) {
+    std::fill(slot->row_bitmap.begin(), slot->row_bitmap.end(), 0);
+    slot->dense_round = false;
+  }
+  if (msg.type.requestType != RequestType::kRowSparsePushPull) {
+    // the worker found its partition too dense to encode
+    CHECK_EQ(msg.len, len);
+    if (first) {
+      bps_reducer_->copy(store, msg.src, len);
+    } else {
+      CHECK_GE(bps_reducer_->sum(store, msg.src, len, bps_type), 0);
+    }
+    slot->dense_round = true;
+    return;
+  }
+  auto payload = reinterpret_cast<const char*>(msg.src);
+  auto header = reinterpret_cast<const common::RowSparseHeader*>(payload);
+  if (slot->row_bitmap.empty()) {
+    slot->row_bytes = header->row_bytes;
+    slot->row_bitmap.resize(
+        common::RowSparseBitmapSize(len, slot->row_bytes), 0);
+  }
+  CHECK_EQ(header->row_bytes, slot->row_bytes)
+      << "row size of key=" << msg.key << " changed";
+  if (first) memset(store, 0, len);
+  common::ScatterAddRowSparse(payload, msg.len, store, len, bps_type,
+                              slot->row_bitmap.data());
+}
+
+// encode the rows pushed in this round as the result of a row-sparse key.
+// return false if the result should be pulled dense.
+bool EncodeRowSparseResult(KeySlot* slot, const BytePSEngineMessage& msg) {
+  if (slot->dense_round || slot->row_bitmap.empty()) return false;
+  auto result = &slot->result;
+  if (!result->tensor) {
+    PageAlignedMalloc((void**)&result->tensor, msg.len);
+    result->len = msg.len;
+    result->dtype = msg.type.dtype;
+  }
+  auto size = common::EncodeRowSparse(reinterpret_cast<char*>(msg.src),
+                                      msg.len, slot->row_bytes,
+                                      slot->row_bitmap.data(), result->tensor);
+  if (!size) return false;
+  slot->update.merged.tensor = result->tensor;
+  slot->update.merged.len = size;
+  return true;
+}
+
+// compress the summed result of a key for pull
+void CompressResult(KeySlot* slot, const BytePSEngineMessage& msg) {
+  auto start_ns = telemetry_ ? NowNs() : 0;
+  auto pull_compressor = slot->pull_compressor.get();
+  CHECK(pull_compressor);
+  auto fp16_copy = GetFP16Copy(msg.key);
+  common::compressor::tensor_t grad(reinterpret_cast<char*>(msg.src), msg.len,
+                                    msg.type.dtype),
+      compressed{fp16_copy->tensor};
+  pull_compressor->Compress(grad, compressed);
+  slot->update.merged.tensor = compressed.data;
+  slot->update.merged.len = compressed.size;
+  if (telemetry_) {
+    telemetry_->Record(kCompress, NowNs() - start_ns, &slot->stats);
+  }
+}
+
+// the result of a round is ready, serve the pulls waiting for it. tid is the
+// engine thread of the key, whose flags guard its pull states.
+void FinishRound(const BytePSEngineMessage& msg, size_t tid) {
+  auto slot = GetSlot(msg.key);
+  if (telemetry_) telemetry_->FinishRound(&slot->stats);
+  std::lock_guard<std::mutex> lock(flag_mu_[tid]);
+  if (backup_worker_num_) {
+    // serve the pulls of the workers whose round is done, including
+    // the ones whose late push was dropped
+    auto ready = ++slot->ready_round;
+    auto& pulls = slot->pending_pulls;
+    auto it = pulls.begin();
+    while (it != pulls.end()) {
+      if (it->first <= ready) {
+        SendPullResponse(msg.type, msg.key, it->second, byteps_server_);
+        it = pulls.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return;
+  }
+  if (is_push_finished_[tid].find(msg.key) == is_push_finished_[tid].end()) {
+    is_push_finished_[tid][msg.key] = false;
+    pull_cnt_[tid][msg.key] = 0;
+    seen_sender_[tid][msg.key].clear();
+  }
+  is_push_finished_[tid][msg.key] = true;
+
+  auto it = q_pull_reqmeta_[tid][msg.key].begin();
+  while (it != q_pull_reqmeta_[tid][msg.key].end()) {
+    if (seen_sender_[tid][msg.key].find(it->sender) ==
+        seen_sender_[tid][msg.key].end()) {
+      SendPullResponse(msg.type, msg.key, *it, byteps_server_);
+      pull_cnt_[tid][msg.key] += 1;
+      seen_sender_[tid][msg.key].insert(it->sender);
+      it = q_pull_reqmeta_[tid][msg.key].erase(it);
+    } else {
+      ++it;
+    }
+    if (pull_cnt_[tid][msg.key] == GetNumPullers(msg.key)) {
+      is_push_finished_[tid][msg.key] = false;
+      pull_cnt_[tid][msg.key] = 0;
+      seen_sender_[tid][msg.key].clear();
+      break;
+    }
+  }
+}
+
+// compress the results of rounds off the engine threads, so that the keys
+// queued behind them are summed meanwhile. the keys are sharded over the
+// threads, which keeps the rounds of a key in order.
+void BytePSServerCompressThread(int i) {
+  auto& q = compress_queues_[i];
+  while (true) {
+    BytePSEngineMessage msg;
+    q->WaitAndPop(&msg);
+    if (msg.ops == TERMINATE) break;
+    auto slot = GetSlot(msg.key);
+    CompressResult(slot, msg);
+    FinishRound(msg, slot->tid.load(std::memory_order_acquire));
   }
 }
 
 void BytePSServerEngineThread(int i) {
+  if (!engine_numa_node_.empty()) {
+    // buffers first touched by this thread (e.g., in compressors) are
+    // allocated on its node as well
+    auto node = engine_numa_node_[i];
+    CHECK_EQ(numa_run_on_node(node), 0) << "failed to run on node " << node;
+    numa_set_preferred(node);
+  }
   auto& q = engine_queues_[i];
+  // popped while folding sums but not foldable, handled next
+  BytePSEngineMessage pending;
+  bool has_pending = false;
+  // pushes folded into the sum of the current message
+  std::vector<BytePSEngineMessage> folded;
+  std::vector<const void*> srcs;
+  EngineBacklog backlog;
   while (true) {
+    DrainBacklog(&backlog);
     BytePSEngineMessage msg;
-    q->WaitAndPop(&msg);
+    if (has_pending) {
+      msg = std::move(pending);
+      has_pending = false;
+    } else {
+      // retry the backlog until a message arrives, instead of parking
+      bool popped = false;
+      while (!backlog.empty() && !(popped = q->TryPop(&msg))) {
+        std::this_thread::yield();
+        DrainBacklog(&backlog);
+      }
+      if (!popped) q->WaitAndPop(&msg);
+    }
     if (msg.ops == TERMINATE) break;
     // do some check
     CHECK(msg.dst);
     CHECK(msg.src);
 
-    auto iter = compressor_map_.find(msg.key);
-    if (iter != compressor_map_.end()) {
+    auto start = std::chrono::steady_clock::now();
+    auto slot = GetSlot(msg.key);
+    if (telemetry_ && msg.ops == ALL_RECV) {
+      auto start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          start.time_since_epoch())
+                          .count();
+      telemetry_->Record(kQueueWait, start_ns - slot->stats.last_push_ns,
+                         &slot->stats);
+    }
+    if (msg.ops == ALL_RECV && backup_worker_num_) {
+      // only a quorum of the pushes is summed, scale it up to all workers
+      float alpha = static_cast<float>(GetNumPushers(msg.key)) /
+                    GetQuorum(msg.key);
+      CHECK_GE(bps_reducer_->scale(msg.src, msg.len,
+                                   bps_reducer_->GetDataType(msg.type.dtype),
+                                   alpha),
+               0);
+    }
+    if (msg.ops == ALL_RECV && slot->server_update) {
+      CHECK_EQ(msg.type.dtype, common::BYTEPS_FLOAT32)
+          << "server optimizer only supports float32 and float16 tensors";
+      auto grad = reinterpret_cast<float*>(msg.src);
+      auto& optimizer = slot->optimizer;
+      if (!optimizer) {
+        // the first round carries the initial weights from every worker,
+        // unless a former server left its weights in the snapshot
+        optimizer = CreateOptimizer(optimizer_params_, msg.len / sizeof(float),
+                                    snapshot_.get(), msg.key);
+        if (!optimizer->restored()) {
+          optimizer->Init(grad, 1.0f / GetNumPushers(msg.key));
+        }
+      } else {
+        optimizer->Step(grad);
+      }
+      // workers pull the updated weights in place of the summed gradients
+      bps_reducer_->copy(msg.src, optimizer->weight(), msg.len);
+    }
+    auto compressor = slot->compressor.get();
+    bool is_result = (msg.ops == ALL_RECV || msg.ops == SEND_PULL);
+    // handed over to the compression threads, which also serve the pulls
+    bool defer_compress =
+        compressor && msg.ops == ALL_RECV && !compress_queues_.empty();
+    if (compressor) {
       // compress
-      if (msg.ops == ALL_RECV) {
-        auto fp16_copy = GetFP16Copy(msg.key);
-        common::compressor::tensor_t grad(reinterpret_cast<char*>(msg.src),
-                                          msg.len, msg.type.dtype),
-            compressed{fp16_copy->tensor};
-        iter->second->Compress(grad, compressed);
+      if (is_result) {
         // 1. compress
-        auto updates = GetUpdate(msg.key);
-        updates->merged.tensor = compressed.data;
-        updates->merged.len = compressed.size;
+        if (!defer_compress) CompressResult(slot, msg);
       } else {  // decompress
         auto compressed_len = msg.sarray.lens[0];
         CHECK_LE(compressed_len, msg.len);
         common::compressor::tensor_t compressed(
             reinterpret_cast<char*>(msg.src), compressed_len, msg.type.dtype),
             decompressed;
-        iter->second->Decompress(compressed, decompressed);
+        compressor->Decompress(compressed, decompressed);
         msg.src = decompressed.data;
         msg.len = decompressed.size;
         msg.type.dtype = decompressed.dtype;
         msg.mixed_precision = false;  // have already been in FP32
       }
     } else {
-      if (msg.ops == ALL_RECV) {
+      if (is_result) {
         // 2. no compress
         auto updates = GetUpdate(msg.key);
 
@@ -134,6 +380,20 @@ void BytePSServerEngineThread(int i) {
               static_cast<common::DataType>(fp16_copy->dtype), false);
           updates->merged.tensor = fp16_copy->tensor;
           updates->merged.len = fp16_copy->len;
+        } else if (msg.ops == ALL_RECV && slot->row_sparse &&
+                   EncodeRowSparseResult(slot, msg)) {
+          // only the rows pushed in this round are pulled
+        } else if (backup_worker_num_) {
+          // fast workers may push the next round before slow ones pull
+          auto result = &slot->result;
+          if (!result->tensor) {
+            PageAlignedMalloc((void**)&result->tensor, msg.len);
+            result->len = msg.len;
+            result->dtype = msg.type.dtype;
+          }
+          bps_reducer_->copy(result->tensor, msg.src, msg.len);
+          updates->merged.tensor = result->tensor;
+          updates->merged.len = msg.len;
         } else {
           updates->merged.tensor = reinterpret_cast<char*>(msg.src);
           updates->merged.len = msg.len;
@@ -159,6 +419,8 @@ void BytePSServerEngineThread(int i) {
         if (msg.mixed_precision) {
           bps_reducer_->copy_mixed_precision(msg.dst, msg.src, msg.len,
                                              bps_type, true);
+        } else if (slot->row_sparse) {
+          SumRowSparse(slot, msg, true);
         } else {
           bps_reducer_->copy(msg.dst, msg.src, msg.len);
         }
@@ -175,31 +437,30 @@ void BytePSServerEngineThread(int i) {
       } break;
 
       case ALL_RECV: {
-        std::lock_guard<std::mutex> lock(flag_mu_[i]);
-        if (is_push_finished_[i].find(msg.key) == is_push_finished_[i].end()) {
-          is_push_finished_[i][msg.key] = false;
-          pull_cnt_[i][msg.key] = 0;
-          seen_sender_[i][msg.key].clear();
+        if (defer_compress) {
+          compress_queues_[msg.key % compress_queues_.size()]->Push(msg);
+        } else {
+          FinishRound(msg, i);
         }
-        is_push_finished_[i][msg.key] = true;
-
-        auto it = q_pull_reqmeta_[i][msg.key].begin();
-        while (it != q_pull_reqmeta_[i][msg.key].end()) {
-          if (seen_sender_[i][msg.key].find(it->sender) ==
-              seen_sender_[i][msg.key].end()) {
-            SendPullResponse(msg.type, msg.key, *it, byteps_server_);
-            pull_cnt_[i][msg.key] += 1;
-            seen_sender_[i][msg.key].insert(it->sender);
-            it = q_pull_reqmeta_[i][msg.key].erase(it);
-          } else {
-            ++it;
-          }
-          if (pull_cnt_[i][msg.key] == (size_t)ps::NumWorkers()) {
-            is_push_finished_[i][msg.key] = false;
-            pull_cnt_[i][msg.key] = 0;
-            seen_sender_[i][msg.key].clear();
-            break;
-          }
+      } break;
+
+      case SEND_PULL: {
+        SendPullResponse(msg.type, msg.key, msg.req_meta, byteps_server_);
+      } break;
+
+      case SUM_FIRST: {
+        CHECK(msg.src2);
+        CHECK_GE(bps_reducer_->sum(msg.dst, msg.src, msg.src2, msg.len,
+                                   bps_type),
+                 0);
+        if (is_debug) {
+          std::lock_guard<std::mutex> lock(debug_mu_);
+          LOG(INFO) << "stage: ENGINE_SUM_FIRST_AFTER \t"
+                    << "dst: " << DEBUG_PRINT_TENSOR_VALUE(msg.dst) << "\t"
+                    << "src: " << DEBUG_PRINT_TENSOR_VALUE(msg.src) << "\t"
+                    << "src2: " << DEBUG_PRINT_TENSOR_VALUE(msg.src2) << "\t"
+                    << "dst_addr: " << DEBUG_PRINT_TENSOR_ADDRESS(msg.dst)
+                    << "\t";
         }
       } break;
 
@@ -218,8 +479,32 @@ void BytePSServerEngineThread(int i) {
         if (msg.mixed_precision) {
           bps_reducer_->sum_mixed_precision(msg.dst, msg.src, msg.len,
                                             bps_type);
+        } else if (slot->row_sparse) {
+          SumRowSparse(slot, msg, false);
         } else {
-          CHECK_GE(bps_reducer_->sum(msg.dst, msg.src, msg.len, bps_type), 0);
+          // sum the pushes of the same buffer queued behind this one in a
+          // single pass, which writes the store once. Only in arrival
+          // order: the scheduled queue would hand over a message of another
+          // key ahead of its turn.
+          while (!enable_schedule_ && !compressor &&
+                 folded.size() + 2 < kMaxSumSources && q->TryPop(&pending)) {
+            if (pending.ops != SUM_RECV || pending.dst != msg.dst ||
+                pending.len != msg.len || pending.mixed_precision) {
+              has_pending = true;
+              break;
+            }
+            folded.push_back(std::move(pending));
+          }
+          if (folded.empty()) {
+            CHECK_GE(bps_reducer_->sum(msg.dst, msg.src, msg.len, bps_type),
+                     0);
+          } else {
+            srcs = {msg.dst, msg.src};
+            for (auto& m : folded) srcs.push_back(m.src);
+            CHECK_GE(bps_reducer_->sum(msg.dst, srcs.data(), srcs.size(),
+                                       msg.len, bps_type),
+                     0);
+          }
         }
 
         if (is_debug) {
@@ -236,36 +521,168 @@ void BytePSServerEngineThread(int i) {
       default:
         CHECK(0);
     }
+    if (rebalance_interval_ && !msg.striped) {
+      auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      slot->cost_ns.fetch_add(cost, std::memory_order_relaxed);
+    }
+    if (telemetry_ && (msg.ops == COPY_FIRST || msg.ops == SUM_FIRST ||
+                       msg.ops == SUM_RECV)) {
+      auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      if (sync_mode_) {
+        // recorded once the round finishes
+        slot->stats.round_sum_ns.fetch_add(cost, std::memory_order_relaxed);
+      } else {
+        telemetry_->Record(kSum, cost, &slot->stats);
+      }
+    }
+    for (auto& m : folded) {
+      if (m.striped) FinishStripe(m.key, &backlog);
+    }
+    folded.clear();
+    if (msg.striped) FinishStripe(msg.key, &backlog);
   }
-}  // namespace server
+}
+
+// periodically move keys from the busiest engine thread to the idlest one,
+// based on the engine time measured for each key. the migration itself is
+// done by MigrateKey at the next round of the key.
+void BytePSServerRebalanceThread() {
+  struct KeyCost {
+    uint64_t cost;
+    int tid;
+    KeySlot* slot;
+  };
+  std::unique_lock<std::mutex> lock(rebalance_mu_);
+  while (!rebalance_cv_.wait_for(
+      lock, std::chrono::milliseconds(rebalance_interval_),
+      [] { return rebalance_stop_; })) {
+    std::vector<uint64_t> thread_cost(engine_thread_num_, 0);
+    std::vector<KeyCost> keys;
+    key_table_->ForEach([&](KeySlot* slot) {
+      int tid = slot->next_tid.load(std::memory_order_relaxed);
+      if (tid < 0) tid = slot->tid.load(std::memory_order_acquire);
+      if (tid < 0) return;
+      auto cost = slot->cost_ns.exchange(0, std::memory_order_relaxed);
+      thread_cost[tid] += cost;
+      keys.push_back({cost, tid, slot});
+    });
+    std::sort(keys.begin(), keys.end(), [](const KeyCost& a, const KeyCost& b) {
+      return a.cost > b.cost;
+    });
+
+    // greedy: move the largest key that narrows the gap between the
+    // busiest and the idlest thread
+    for (size_t n = 0; n < keys.size(); ++n) {
+      auto minmax = std::minmax_element(thread_cost.begin(), thread_cost.end());
+      int min_tid = minmax.first - thread_cost.begin();
+      int max_tid = minmax.second - thread_cost.begin();
+      auto gap = thread_cost[max_tid] - thread_cost[min_tid];
+      // not worth a migration
+      if (gap <= thread_cost[max_tid] / 10) break;
+      auto it = std::find_if(keys.begin(), keys.end(), [&](const KeyCost& k) {
+        return k.tid == max_tid && k.cost > 0 && k.cost < gap;
+      });
+      if (it == keys.end()) break;
+      thread_cost[max_tid] -= it->cost;
+      thread_cost[min_tid] += it->cost;
+      it->tid = min_tid;
+      it->slot->next_tid.store(min_tid, std::memory_order_release);
+      if (log_key_info_) {
+        LOG(INFO) << "rebalance: move a key of cost " << it->cost
+                  << "ns from engine thread " << max_tid << " to " << min_tid;
+      }
+    }
+  }
+}
+
+// move a key to the engine thread picked by the rebalancer. it is called
+// before the first push of a round, and only takes effect when all pulls of
+// the last round are served, so no message of the key is in flight.
+void MigrateKey(uint64_t key) {
+  auto slot = GetSlot(key);
+  int next = slot->next_tid.load(std::memory_order_acquire);
+  if (next < 0) return;
+  int tid = slot->tid.load(std::memory_order_relaxed);
+  if (tid >= 0 && tid != next) {
+    std::lock_guard<std::mutex> lock(flag_mu_[tid]);
+    auto finished = is_push_finished_[tid].find(key);
+    if (finished != is_push_finished_[tid].end() && finished->second) return;
+    auto pending = q_pull_reqmeta_[tid].find(key);
+    if (pending != q_pull_reqmeta_[tid].end() && !pending->second.empty())
+      return;
+    is_push_finished_[tid].erase(key);
+    q_pull_reqmeta_[tid].erase(key);
+    seen_sender_[tid].erase(key);
+    pull_cnt_[tid].erase(key);
+    {
+      std::lock_guard<std::mutex> lock(hash_mu_);
+      acc_load_[tid] -= slot->load;
+      acc_load_[next] += slot->load;
+    }
+    if (!engine_numa_node_.empty() &&
+        engine_numa_node_[tid] != engine_numa_node_[next]) {
+      MoveToNumaNode(slot->store.tensor, slot->store.len,
+                     engine_numa_node_[next]);
+      MoveToNumaNode(slot->spare_store, slot->store.len,
+                     engine_numa_node_[next]);
+      MoveToNumaNode(slot->fp16_copy.tensor, slot->fp16_copy.len,
+                     engine_numa_node_[next]);
+      MoveCompressorsToNumaNode(slot, engine_numa_node_[next]);
+    }
+    slot->tid.store(next, std::memory_order_release);
+  }
+  slot->next_tid.store(-1, std::memory_order_relaxed);
+}
 
 void BytePSHandleConfigReq(uint64_t key, DataHandleType type,
                            const ps::KVMeta& req_meta,
                            const ps::KVPairs<char>& req_data,
                            ps::KVServer<char>* server) {
-  if (compressor_map_.find(key) == compressor_map_.end()) {
+  auto slot = GetSlot(key);
+  if (!slot->compressor) {
     std::string content{reinterpret_cast<char*>(req_data.vals.data()),
                         static_cast<size_t>(req_data.lens[0])};
     auto kwargs = byteps::common::compressor::Deserialize(content);
-    auto stored = GetStore(key);
+    auto pull_kwargs = byteps::common::compressor::GetPullKwargs(kwargs);
+    auto stored = &slot->store;
     size_t aligned_size = byteps::common::Align(stored->len);
+    auto dtype = static_cast<byteps::common::DataType>(stored->dtype);
+
+    // push direction only decompresses, so error-feedback is not needed
+    kwargs.erase("ef_type");
     auto compressor_ptr =
         byteps::common::compressor::CompressorRegistry::Create(
-            kwargs, aligned_size,
-            static_cast<byteps::common::DataType>(stored->dtype));
+            kwargs, aligned_size, dtype);
     CHECK_NE(compressor_ptr, nullptr);
-    compressor_map_[key] = std::move(compressor_ptr);
+
+    auto pull_compressor_ptr =
+        byteps::common::compressor::CompressorRegistry::Create(
+            pull_kwargs, aligned_size, dtype);
+    CHECK_NE(pull_compressor_ptr, nullptr);
+    slot->pull_compressor = std::move(pull_compressor_ptr);
+    slot->compressor = std::move(compressor_ptr);
+    auto tid = slot->tid.load(std::memory_order_acquire);
+    if (!engine_numa_node_.empty() && tid >= 0) {
+      // otherwise GetThreadID moves them along with the store
+      MoveCompressorsToNumaNode(slot, engine_numa_node_[tid]);
+    }
     if (log_key_info_) {
-      LOG(INFO) << "register compressor for key=" << key;
+      LOG(INFO) << "register compressor for key=" << key
+                << ", push=" << kwargs["compressor_type"]
+                << ", pull=" << pull_kwargs["compressor_type"];
     }
   }
 
   // buffer the request meta
-  auto& updates = update_buf_[key];
+  auto& updates = slot->update;
   updates.request.push_back(req_meta);
 
   // should send response after collecting all init push
-  if (updates.request.size() < (size_t)ps::NumWorkers()) return;
+  if (updates.request.size() < GetNumIniters(key)) return;
 
   for (const auto& req : updates.request) {
     SendPushResponse(key, req, server);
@@ -278,15 +695,15 @@ void BytePSHanleInit(uint64_t key, DataHandleType type, size_t len,
                      BytePSArray* stored, const ps::KVMeta& req_meta,
                      const ps::KVPairs<char>& req_data,
                      ps::KVServer<char>* server, bool mixed_precision) {
-  if (sync_mode_ && (update_buf_.find(key) == update_buf_.end())) {
-    update_buf_[key].merged.len = len;
-    update_buf_[key].merged.dtype = type.dtype;
-  }
   // buffer the request meta
-  auto& updates = update_buf_[key];
+  auto& updates = *GetUpdate(key);
+  if (sync_mode_ && updates.request.empty() && !updates.merged.tensor) {
+    updates.merged.len = len;
+    updates.merged.dtype = type.dtype;
+  }
   updates.request.push_back(req_meta);
   // should send response after collecting all init push
-  if (updates.request.size() < (size_t)ps::NumWorkers()) return;
+  if (updates.request.size() < GetNumIniters(key)) return;
   if (log_key_info_) {
     LOG(INFO) << "Collected all " << updates.request.size()
               << " requests for key=" << key
@@ -296,19 +713,34 @@ void BytePSHanleInit(uint64_t key, DataHandleType type, size_t len,
   int dtype = type.dtype;
   if (mixed_precision) {
     // allocate fp16 copy memory
-    auto* fp16_copy = &fp16_copy_[key];
-    PageAlignedMalloc((void**)&fp16_copy->tensor, len);
+    auto* fp16_copy = GetFP16Copy(key);
     fp16_copy->len = len;
     fp16_copy->dtype = dtype;
-    CHECK(fp16_copy->tensor);
 
     // promote to float32
     common::Promote(len, dtype);
+
+    // it also holds the compressed float32 results for pulls, which have a
+    // header and may be the results as is, e.g., with randomk
+    PageAlignedMalloc(
+        (void**)&fp16_copy->tensor,
+        common::Align(len + sizeof(common::compressor::PayloadHeader)));
+    CHECK(fp16_copy->tensor);
   }
 
   size_t aligned_size = common::Align(len);
-  // init stored buffer, use page aligned memory
-  PageAlignedMalloc((void**)&stored->tensor, aligned_size);
+  if (snapshot_ && !sync_mode_) {
+    // the store holds the weights in asynchronous training
+    bool restored;
+    stored->tensor = static_cast<char*>(snapshot_->Acquire(
+        key, kSnapshotStore, aligned_size, &restored));
+    if (restored && log_key_info_) {
+      LOG(INFO) << "restored the store of key=" << key << " from snapshot";
+    }
+  } else {
+    // init stored buffer, use page aligned memory
+    PageAlignedMalloc((void**)&stored->tensor, aligned_size);
+  }
   stored->len = len;
   stored->dtype = dtype;
   CHECK(stored->tensor);
@@ -325,16 +757,81 @@ void BytePSHandlePush(uint64_t key, DataHandleType type, size_t len,
                       const ps::KVMeta& req_meta,
                       const ps::KVPairs<char>& req_data,
                       ps::KVServer<char>* server, bool mixed_precision) {
-  auto& updates = update_buf_[key];
+  auto slot = GetSlot(key);
+  auto& updates = slot->update;
   float workload = stored->len;
 
-  auto iter = compressor_map_.find(key);
-  if (iter != compressor_map_.end()) {
+  if (backup_worker_num_) {
+    // the worker is late if the round after its last push is released
+    auto& round = slot->sender_round[req_meta.sender];
+    auto& pull_round = slot->pull_round[req_meta.sender];
+    if (round < slot->quorum_round) {
+      // drop it, so that it is never summed into a later round. the worker
+      // pulls the result of the round it missed, and joins the current round
+      // with its next push.
+      pull_round = round + 1;
+      round = slot->quorum_round;
+      if (log_key_info_) {
+        LOG(INFO) << "drop a late push of key=" << key
+                  << " from sender=" << req_meta.sender;
+      }
+      SendPushResponse(key, req_meta, server);
+      return;
+    }
+    round += 1;
+    pull_round = round;
+  }
+
+  if (rebalance_interval_ && updates.request.empty()) {
+    MigrateKey(key);
+  }
+
+  if (telemetry_ && sync_mode_) {
+    auto& stats = slot->stats;
+    auto now = NowNs();
+    if (updates.request.empty()) {
+      stats.key = key;
+      stats.first_push_ns = now;
+      stats.round_sum_ns.store(0, std::memory_order_relaxed);
+    }
+    stats.last_push_ns = now;
+  }
+
+  bool is_compressed = (slot->compressor != nullptr);
+  if (is_compressed) {
     workload *= lb_factor_;
   }
 
   auto tid = GetThreadID(key, int(workload));
+  bool is_striped = sync_mode_ && !is_engine_blocking_ && stripe_size_ &&
+                    engine_thread_num_ > 1 && !mixed_precision &&
+                    !is_compressed && !slot->row_sparse &&
+                    len > 2 * stripe_size_;
+  auto push_to_engine = [&](const BytePSEngineMessage& msg) {
+    if (is_striped) {
+      PushStripes(tid, msg);
+    } else {
+      engine_queues_[tid]->Push(msg);
+    }
+  };
   if (updates.request.empty()) {  // from the first incoming worker
+    if (sync_mode_ && double_buffer_ && !is_engine_blocking_ &&
+        !mixed_precision && !is_compressed && !backup_worker_num_) {
+      // pulls of plain keys are served from the store. sum this round into
+      // the other buffer, so that fast workers can push it while the result
+      // of the last round is still pulled by slow workers. a worker pushes a
+      // key only after it pulled the last round, so no pull of the round
+      // before it is left, and its buffer is free to reuse.
+      if (!slot->spare_store) {
+        PageAlignedMalloc((void**)&slot->spare_store,
+                          common::Align(stored->len));
+        if (!engine_numa_node_.empty()) {
+          MoveToNumaNode(slot->spare_store, stored->len,
+                         engine_numa_node_[tid]);
+        }
+      }
+      std::swap(stored->tensor, slot->spare_store);
+    }
     if (sync_mode_) {
       if (debug_mode_ && (debug_key_ == key)) {
         std::lock_guard<std::mutex> lock(debug_mu_);
@@ -347,15 +844,45 @@ void BytePSHandlePush(uint64_t key, DataHandleType type, size_t len,
       }
 
       updates.merged.tmp_sarray = req_data;
-      // copy
-      BytePSEngineMessage msg = {
-          timestamp_++, type,       key,      stored->tensor, recved,
-          len,          COPY_FIRST, req_data, req_meta,       mixed_precision};
-      engine_queues_[tid]->Push(msg);
-    } else {  // async mode, directly add to the buffer
+      if (is_striped) {
+        // hold ALL_RECV back until all pushes arrive
+        slot->stripe_pending.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (!is_engine_blocking_ && !mixed_precision && !is_compressed &&
+          !slot->row_sparse) {
+        // no copy, the second push is summed with it into the store
+        updates.defer_first = true;
+      } else {
+        // copy
+        BytePSEngineMessage msg = {
+            timestamp_++, type,       key,      stored->tensor, recved,
+            len,          COPY_FIRST, req_data, req_meta,       mixed_precision};
+        push_to_engine(msg);
+      }
+    } else if (is_engine_blocking_) {
+      // async mode, directly add to the buffer
       CHECK_GE(bps_reducer_->sum((void*)stored->tensor, (void*)recved, len,
                                  bps_reducer_->GetDataType(stored->dtype)),
                0);
+    } else {  // async mode, summed by the engine thread of the key in order
+      auto it = slot->pulled_version.find(req_meta.sender);
+      uint64_t base = (it == slot->pulled_version.end()) ? 0 : it->second;
+      if (max_staleness_ >= 0 &&
+          slot->async_version - base > static_cast<uint64_t>(max_staleness_)) {
+        // computed on weights that are too old, the worker pulls the latest
+        // ones next
+        if (log_key_info_) {
+          LOG(INFO) << "reject a push of key=" << key << " from sender="
+                    << req_meta.sender << " with staleness "
+                    << slot->async_version - base;
+        }
+      } else {
+        ++slot->async_version;
+        BytePSEngineMessage msg = {
+            timestamp_++, type,     key,      stored->tensor, recved,
+            len,          SUM_RECV, req_data, req_meta,       mixed_precision};
+        engine_queues_[tid]->Push(msg);
+      }
     }
   } else {  // from other workers
     CHECK(sync_mode_);
@@ -378,14 +905,27 @@ void BytePSHandlePush(uint64_t key, DataHandleType type, size_t len,
       BytePSEngineMessage msg = {
           timestamp_++, type,     key,      stored->tensor, recved,
           len,          SUM_RECV, req_data, req_meta,       mixed_precision};
-      engine_queues_[tid]->Push(msg);
+      if (updates.defer_first) {
+        // store = first + recved. the first push is kept alive by
+        // tmp_sarray, which is only replaced after ALL_RECV of this round
+        msg.ops = SUM_FIRST;
+        msg.src2 = updates.merged.tmp_sarray.vals.data();
+        updates.defer_first = false;
+      }
+      push_to_engine(msg);
     }
   }
   // add a worker information (request.size() is the # workers received)
   updates.request.push_back(req_meta);
   SendPushResponse(key, req_meta, server);
-  if (sync_mode_ && updates.request.size() == (size_t)ps::NumWorkers()) {
+  auto quorum = backup_worker_num_ ? GetQuorum(key) : GetNumPushers(key);
+  if (sync_mode_ && updates.request.size() == quorum) {
     auto& update = updates.merged;
+    if (telemetry_) {
+      auto& stats = slot->stats;
+      telemetry_->Record(kPushSpread,
+                         stats.last_push_ns - stats.first_push_ns, &stats);
+    }
     if (debug_mode_ && (debug_key_ == key)) {
       std::lock_guard<std::mutex> lock(debug_mu_);
       LOG(INFO) << "stage: ALL_RECV \t"
@@ -397,6 +937,13 @@ void BytePSHandlePush(uint64_t key, DataHandleType type, size_t len,
       // TODO: compress
       bps_reducer_->copy(stored->tensor, updates.merged.tensor, len);
     } else {
+      if (updates.defer_first) {  // single worker, nothing to sum with
+        BytePSEngineMessage msg = {
+            timestamp_++, type,       key,      stored->tensor, recved,
+            len,          COPY_FIRST, req_data, req_meta,       mixed_precision};
+        push_to_engine(msg);
+        updates.defer_first = false;
+      }
       BytePSEngineMessage msg = {timestamp_++,
                                  {type.requestType, stored->dtype},
                                  key,
@@ -407,10 +954,18 @@ void BytePSHandlePush(uint64_t key, DataHandleType type, size_t len,
                                  req_data,
                                  req_meta,
                                  mixed_precision};
-      engine_queues_[tid]->Push(msg);
-      engine_queues_[tid]->ClearCounter(key);
+      if (is_striped) {
+        // sent by whichever thread finishes the last stripe
+        slot->all_recv = msg;
+        for (auto q : engine_queues_) q->ClearCounter(key);
+        FinishStripe(key);
+      } else {
+        engine_queues_[tid]->Push(msg);
+        engine_queues_[tid]->ClearCounter(key);
+      }
     }
     updates.request.clear();
+    slot->quorum_round += 1;
   } else if (!sync_mode_) {
     // async: clean the request buffer
     updates.request.clear();
@@ -422,8 +977,38 @@ void BytePSHandlePull(uint64_t key, DataHandleType type, BytePSArray* stored,
                       const ps::KVPairs<char>& req_data,
                       ps::KVServer<char>* server) {
   CHECK(stored->tensor) << "Should init the buffer for key=" << key << " first";
-  if (is_engine_blocking_ || !sync_mode_) {
+  if (is_engine_blocking_) {
     SendPullResponse(type, key, req_meta, server);
+  } else if (!sync_mode_) {
+    auto slot = GetSlot(key);
+    slot->pulled_version[req_meta.sender] = slot->async_version;
+    // served by the engine thread, so that a worker sees its own pushes
+    BytePSEngineMessage msg = {timestamp_++,
+                               {type.requestType, stored->dtype},
+                               key,
+                               stored->tensor,
+                               stored->tensor,
+                               stored->len,
+                               SEND_PULL,
+                               req_data,
+                               req_meta,
+                               type.dtype == common::BYTEPS_FLOAT16};
+    engine_queues_[GetThreadID(key, 0)]->Push(msg);
+  } else if (backup_worker_num_) {
+    auto slot = GetSlot(key);
+    auto it = slot->pull_round.find(req_meta.sender);
+    // a worker that never pushed waits for the first result, and the key
+    // may not have an engine thread yet
+    uint64_t round = (it == slot->pull_round.end()) ? 1 : it->second;
+    auto tid = GetThreadID(key, stored->len);
+    std::lock_guard<std::mutex> lock(flag_mu_[tid]);
+    if (slot->ready_round >= round) {
+      // the result of a later round replaces the one of a round, so a late
+      // worker gets the newest result at least as recent as it needs
+      SendPullResponse(type, key, req_meta, server);
+    } else {
+      slot->pending_pulls.emplace_back(round, req_meta);
+    }
   } else {
     auto tid = GetThreadID(key, 0);
     std::lock_guard<std::mutex> lock(flag_mu_[tid]);
@@ -441,7 +1026,7 @@ void BytePSHandlePull(uint64_t key, DataHandleType type, BytePSArray* stored,
       pull_cnt_[tid][key] += 1;
       seen_sender_[tid][key].insert(req_meta.sender);
 
-      if (pull_cnt_[tid][key] == (size_t)ps::NumWorkers()) {
+      if (pull_cnt_[tid][key] == GetNumPullers(key)) {
         is_push_finished_[tid][key] = false;
         pull_cnt_[tid][key] = 0;
         seen_sender_[tid][key].clear();
@@ -467,6 +1052,16 @@ void BytePSHandleDefaultReq(uint64_t key, DataHandleType type,
 
     auto len = (size_t)req_data.lens[0];
     if (!stored->tensor) {
+      if (type.requestType == RequestType::kServerUpdatePushPull) {
+        CHECK(!optimizer_params_.type.empty())
+            << "set BYTEPS_SERVER_OPTIMIZER on servers to update key=" << key;
+        GetSlot(key)->server_update = true;
+      } else if (type.requestType == RequestType::kRowSparsePushPull) {
+        CHECK(!mixed_precision && !is_engine_blocking_)
+            << "row-sparse key=" << key
+            << " does not support float16 or the blocking engine";
+        GetSlot(key)->row_sparse = true;
+      }
       // initialize buffer
       BytePSHanleInit(key, type, len, stored, req_meta, req_data, server,
                       mixed_precision);
@@ -482,10 +1077,11 @@ void BytePSHandleDefaultReq(uint64_t key, DataHandleType type,
   }
 }
 
-void BytePSHandler(const ps::KVMeta& req_meta,
-                   const ps::KVPairs<char>& req_data,
-                   ps::KVServer<char>* server) {
-  std::lock_guard<std::mutex> lock(handle_mu_);  // push & pull may have racing
+// requests of the same key must be handled by the same thread in arrival
+// order, as the key states and is_push_finished_ rely on it
+void BytePSHandleRequest(const ps::KVMeta& req_meta,
+                         const ps::KVPairs<char>& req_data,
+                         ps::KVServer<char>* server) {
   DataHandleType type = DepairDataHandleType(req_meta.cmd);
   // do some check
   CHECK_EQ(req_data.keys.size(), (size_t)1);
@@ -510,13 +1106,45 @@ void BytePSHandler(const ps::KVMeta& req_meta,
       return BytePSHandleDefaultReq(key, type, req_meta, req_data, server);
     case RequestType::kCompressedPushPull:
       return BytePSHandleDefaultReq(key, type, req_meta, req_data, server);
+    case RequestType::kServerUpdatePushPull:
+      return BytePSHandleDefaultReq(key, type, req_meta, req_data, server);
     case RequestType::kRowSparsePushPull:
-      BPS_CHECK(0) << "Not implemented.";
+      return BytePSHandleDefaultReq(key, type, req_meta, req_data, server);
     default:
       BPS_CHECK(0) << "Unrecognized request type.";
   }
 }
 
+void BytePSServerHandlerThread(int i) {
+  auto& q = handler_queues_[i];
+  while (true) {
+    BytePSHandleMessage msg;
+    q->WaitAndPop(&msg);
+    if (msg.terminate) break;
+    BytePSHandleRequest(msg.req_meta, msg.req_data, byteps_server_);
+  }
+}
+
+void BytePSHandler(const ps::KVMeta& req_meta,
+                   const ps::KVPairs<char>& req_data,
+                   ps::KVServer<char>* server) {
+  if (handler_thread_num_ == 0) {
+    return BytePSHandleRequest(req_meta, req_data, server);
+  }
+  // shard by key so that different keys are handled concurrently
+  CHECK_EQ(req_data.keys.size(), (size_t)1);
+  auto tid = DecodeKey(req_data.keys[0]) % handler_thread_num_;
+  BytePSHandleMessage msg;
+  msg.req_meta = req_meta;
+  msg.req_data = req_data;
+  handler_queues_[tid]->Push(std::move(msg));
+}
+
+float GetFloatEnv(const char* key, float default_val) {
+  auto val = getenv(key);
+  return val ? atof(val) : default_val;
+}
+
 void init_global_env() {
   // enable to print key profile
   log_key_info_ = GetEnv("PS_KEY_LOG", false);
@@ -531,6 +1159,15 @@ void init_global_env() {
   if (!sync_mode_)
     LOG(INFO) << "BytePS server is enabled asynchronous training";
 
+  // async mode: reject pushes computed on weights older than this many
+  // pushes of the key
+  max_staleness_ = GetEnv("BYTEPS_SERVER_MAX_STALENESS", -1);
+  if (max_staleness_ >= 0) {
+    LOG(INFO) << "BytePS server bounds the staleness at " << max_staleness_;
+    CHECK(!sync_mode_ && !is_engine_blocking_)
+        << "staleness bound only works with the non-blocking async engine";
+  }
+
   // debug mode
   debug_mode_ = GetEnv("BYTEPS_SERVER_DEBUG", false);
   debug_key_ = GetEnv("BYTEPS_SERVER_DEBUG_KEY", 0);
@@ -545,11 +1182,124 @@ void init_global_env() {
                "performance";
   CHECK_GE(engine_thread_num_, 1);
 
+  // number of threads compressing the results of compressed keys, 0 to
+  // compress on the engine threads
+  compress_thread_num_ = GetEnv("BYTEPS_SERVER_COMPRESS_THREAD", 0);
+  if (compress_thread_num_) {
+    CHECK(sync_mode_ && !is_engine_blocking_)
+        << "compression threads only work with the non-blocking sync engine";
+    LOG(INFO) << "BytePS server compresses results with "
+              << compress_thread_num_ << " threads";
+  }
+
+  // periodically dump the latency of each stage of the rounds to a file
+  auto telemetry_path = getenv("BYTEPS_SERVER_TELEMETRY");
+  if (telemetry_path) {
+    telemetry_path_ = telemetry_path;
+    telemetry_interval_ms_ =
+        GetEnv("BYTEPS_SERVER_TELEMETRY_INTERVAL", 10000);
+    LOG(INFO) << "BytePS server dumps telemetry to " << telemetry_path_
+              << " every " << telemetry_interval_ms_ << "ms";
+  }
+
   // enable scheduling for server engine
   enable_schedule_ = GetEnv("BYTEPS_SERVER_ENABLE_SCHEDULE", false);
   if (enable_schedule_)
     LOG(INFO) << "Enable engine scheduling for BytePS server";
 
+  // alternate the store of plain keys between two buffers by round
+  double_buffer_ = GetEnv("BYTEPS_SERVER_DOUBLE_BUFFER", 0) != 0;
+
+  // pin engine threads to numa nodes and place tensors accordingly
+  enable_numa_ = GetEnv("BYTEPS_SERVER_ENABLE_NUMA", 0) != 0;
+
+  // carve the buffers of keys out of large pre-faulted arenas
+  buffer_pool_mb_ = GetEnv("BYTEPS_SERVER_BUFFER_POOL_MB", 0);
+  if (buffer_pool_mb_) {
+    CHECK(!enable_numa_)
+        << "BYTEPS_SERVER_BUFFER_POOL_MB does not work with numa placement";
+  }
+
+  // capacity of the lock-free engine queue (unused if scheduling is enabled)
+  engine_queue_size_ = GetEnv("BYTEPS_SERVER_ENGINE_QUEUE_SIZE", 4096);
+  CHECK_GE(engine_queue_size_, 2);
+
+  // workers are aggregated through a tree of groups of this size
+  aggregation_group_size_ = GetEnv("BYTEPS_AGGREGATION_GROUP_SIZE", 0);
+  if (aggregation_group_size_)
+    LOG(INFO) << "BytePS server aggregates workers in groups of "
+              << aggregation_group_size_;
+  CHECK(sync_mode_ || !aggregation_group_size_)
+      << "aggregation tree only works with synchronous training";
+
+  // aggregate a round once all but this many workers pushed
+  backup_worker_num_ = GetEnv("BYTEPS_SERVER_BACKUP_WORKERS", 0);
+  if (backup_worker_num_) {
+    LOG(INFO) << "BytePS server does not wait for the slowest "
+              << backup_worker_num_ << " workers";
+    CHECK(sync_mode_ && !is_engine_blocking_)
+        << "backup workers only work with the non-blocking synchronous engine";
+    CHECK(!aggregation_group_size_)
+        << "backup workers do not work with the aggregation tree";
+  }
+
+  // optimizer applied on servers to the keys that workers ask for
+  auto optimizer_type = getenv("BYTEPS_SERVER_OPTIMIZER");
+  if (optimizer_type) {
+    optimizer_params_.type = optimizer_type;
+    optimizer_params_.lr = GetFloatEnv("BYTEPS_SERVER_LR", 0.01f);
+    optimizer_params_.momentum = GetFloatEnv("BYTEPS_SERVER_MOMENTUM", 0.0f);
+    optimizer_params_.beta1 = GetFloatEnv("BYTEPS_SERVER_BETA1", 0.9f);
+    optimizer_params_.beta2 = GetFloatEnv("BYTEPS_SERVER_BETA2", 0.999f);
+    optimizer_params_.eps = GetFloatEnv("BYTEPS_SERVER_EPS", 1e-8f);
+    optimizer_params_.weight_decay =
+        GetFloatEnv("BYTEPS_SERVER_WEIGHT_DECAY", 0.0f);
+    LOG(INFO) << "BytePS server runs the " << optimizer_params_.type
+              << " optimizer with lr=" << optimizer_params_.lr;
+    CHECK(sync_mode_ && !is_engine_blocking_)
+        << "server optimizer only works with the non-blocking synchronous "
+           "engine";
+  }
+
+  // keep the state of keys in a file, and resume from it after restarts
+  auto snapshot_path = getenv("BYTEPS_SERVER_SNAPSHOT");
+  if (snapshot_path) {
+    snapshot_path_ = snapshot_path;
+    snapshot_mb_ = GetEnv("BYTEPS_SERVER_SNAPSHOT_MB", 16384);
+    if (sync_mode_ && optimizer_params_.type.empty()) {
+      LOG(WARNING) << "BYTEPS_SERVER_SNAPSHOT only keeps the weights of "
+                      "asynchronous training or the server optimizer";
+    }
+  }
+
+  // large keys are summed by several engine threads in stripes of this size
+  stripe_size_ = GetEnv("BYTEPS_SERVER_STRIPE_SIZE", 4 * 1024 * 1024);
+  stripe_size_ = RoundUp(stripe_size_, 64);
+
+  // interval of migrating keys among engine threads by measured cost
+  rebalance_interval_ = GetEnv("BYTEPS_SERVER_REBALANCE_INTERVAL", 0);
+  if (rebalance_interval_ && (backup_worker_num_ || !sync_mode_)) {
+    // a key only migrates between rounds, which slow workers delay
+    // indefinitely and async training does not have
+    LOG(WARNING) << "BYTEPS_SERVER_REBALANCE_INTERVAL is ignored with "
+                    "BYTEPS_SERVER_BACKUP_WORKERS or asynchronous training";
+    rebalance_interval_ = 0;
+  }
+  if (rebalance_interval_)
+    LOG(INFO) << "BytePS server rebalances keys every " << rebalance_interval_
+              << " ms";
+
+  // max number of keys on this server
+  max_key_num_ = GetEnv("BYTEPS_SERVER_MAX_KEYS", 65536);
+  CHECK_GE(max_key_num_, 1);
+
+  // number of threads handling incoming requests, sharded by key
+  // 0 means handling them on the ps-lite receiving thread
+  handler_thread_num_ = GetEnv("BYTEPS_SERVER_HANDLER_THREAD", 0);
+  if (handler_thread_num_)
+    LOG(INFO) << "BytePS server handles requests with " << handler_thread_num_
+              << " threads";
+
   char* lb_factor_var = getenv("BYTEPS_SERVER_LOAD_BALANCE_FACTOR");
   if (lb_factor_var) {
     lb_factor_ = atof(lb_factor_var);
@@ -558,12 +1308,34 @@ void init_global_env() {
   }
 }
 
-extern "C" void byteps_server() {
+// start the server but ps-lite, so that BytePSHandler can also be driven in
+// process, see benchmark.cc
+void StartEngine() {
   init_global_env();
 
   // cpu reducer
   bps_reducer_ = new byteps::common::CpuReducer(nullptr);
 
+  // per-key states
+  key_table_.reset(new KeyTable<KeySlot>(max_key_num_));
+  if (buffer_pool_mb_) {
+    buffer_pool_.reset(new BufferPool(buffer_pool_mb_ << 20));
+  }
+  if (!snapshot_path_.empty()) {
+    // up to the step count and 4 optimizer buffers per key
+    snapshot_.reset(new Snapshot(snapshot_path_, max_key_num_ * 8,
+                                 snapshot_mb_ << 20));
+  }
+
+  if (!telemetry_path_.empty()) {
+    telemetry_.reset(new Telemetry(
+        telemetry_path_, telemetry_interval_ms_,
+        [](std::vector<const KeyStats*>* keys) {
+          key_table_->ForEach(
+              [keys](KeySlot* slot) { keys->push_back(&slot->stats); });
+        }));
+  }
+
   // flag mu and its protected map
   std::vector<std::mutex> tmp_flagmu(engine_thread_num_);
   std::vector<std::unordered_map<uint64_t, bool> > tmp_ispushfinished(
@@ -588,16 +1360,115 @@ extern "C" void byteps_server() {
   for (size_t i = 0; i < engine_thread_num_; ++i) {
     acc_load_.push_back(0);
   }
-  if (sync_mode_) {
+  if (!is_engine_blocking_ && enable_numa_ && numa_available() >= 0) {
+    std::vector<int> nodes;
+    for (int n = 0; n <= numa_max_node(); ++n) {
+      if (numa_bitmask_isbitset(numa_all_nodes_ptr, n)) nodes.push_back(n);
+    }
+    for (size_t i = 0; i < engine_thread_num_; ++i) {
+      engine_numa_node_.push_back(nodes[i % nodes.size()]);
+    }
+    LOG(INFO) << "BytePS server engine threads are spread over "
+              << nodes.size() << " numa nodes";
+  }
+  if (sync_mode_ || !is_engine_blocking_) {
     for (size_t i = 0; i < engine_thread_num_; ++i) {
-      auto q = new PriorityQueue(enable_schedule_);
+      EngineQueue* q;
+      if (enable_schedule_) {
+        q = new PriorityQueue();
+      } else {
+        q = new MPSCQueue(engine_queue_size_);
+      }
       engine_queues_.push_back(q);
     }
     for (size_t i = 0; i < engine_thread_num_; ++i) {
       auto t = new std::thread(&BytePSServerEngineThread, i);
       engine_threads_.push_back(t);
     }
+    if (rebalance_interval_ && !is_engine_blocking_ &&
+        engine_thread_num_ > 1) {
+      rebalance_thread_ = new std::thread(&BytePSServerRebalanceThread);
+    }
+  }
+  for (size_t i = 0; i < compress_thread_num_; ++i) {
+    compress_queues_.push_back(new MPSCQueue(engine_queue_size_));
+  }
+  for (size_t i = 0; i < compress_thread_num_; ++i) {
+    auto t = new std::thread(&BytePSServerCompressThread, i);
+    compress_threads_.push_back(t);
+  }
+
+  // init the request handlers
+  for (size_t i = 0; i < handler_thread_num_; ++i) {
+    handler_queues_.emplace_back(
+        new MPSCRing<BytePSHandleMessage>(engine_queue_size_));
+  }
+  for (size_t i = 0; i < handler_thread_num_; ++i) {
+    auto t = new std::thread(&BytePSServerHandlerThread, i);
+    handler_threads_.push_back(t);
+  }
+}
+
+// stop the server once no more requests arrive
+void StopEngine() {
+  for (auto& q : handler_queues_) {
+    BytePSHandleMessage msg;
+    msg.terminate = true;
+    q->Push(std::move(msg));
+  }
+  for (auto t : handler_threads_) t->join();
+  BytePSEngineMessage msg;
+  msg.ops = TERMINATE;
+  for (auto q : engine_queues_) q->Push(msg);
+  if (rebalance_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(rebalance_mu_);
+      rebalance_stop_ = true;
+    }
+    rebalance_cv_.notify_all();
+    rebalance_thread_->join();
+    delete rebalance_thread_;
+    rebalance_thread_ = nullptr;
   }
+  for (auto t : engine_threads_) t->join();
+  for (auto q : engine_queues_) delete q;
+  engine_queues_.clear();
+  // after the engine threads, which may still hand results over
+  for (auto q : compress_queues_) q->Push(msg);
+  for (auto t : compress_threads_) t->join();
+  for (auto q : compress_queues_) delete q;
+  compress_queues_.clear();
+
+  telemetry_.reset();
+  key_table_->ForEach([](KeySlot* slot) {
+    if (slot->store.tensor) {
+      PageAlignedFree(slot->store.tensor);
+    }
+    if (slot->fp16_copy.tensor) {
+      PageAlignedFree(slot->fp16_copy.tensor);
+    }
+    if (slot->spare_store) {
+      PageAlignedFree(slot->spare_store);
+    }
+    if (slot->result.tensor) {
+      PageAlignedFree(slot->result.tensor);
+    }
+  });
+  key_table_.reset();
+  buffer_pool_.reset();
+  if (snapshot_) {
+    LOG(INFO) << "BytePS server restored " << snapshot_->num_restored()
+              << " buffers from snapshot";
+    snapshot_.reset();
+  }
+  if (bps_reducer_) {
+    delete bps_reducer_;
+    bps_reducer_ = nullptr;
+  }
+}
+
+extern "C" void byteps_server() {
+  StartEngine();
 
   // init server instance
   byteps_server_ = new KVServer<SERVER_DATA_TYPE>(0);
@@ -610,30 +1481,11 @@ extern "C" void byteps_server() {
 
   // clean the server resource
   Finalize(0, true);
+  StopEngine();
   if (byteps_server_) {
     delete byteps_server_;
     byteps_server_ = nullptr;
   }
-  if (bps_reducer_) {
-    delete bps_reducer_;
-    bps_reducer_ = nullptr;
-  }
-  BytePSEngineMessage msg;
-  msg.ops = TERMINATE;
-  for (auto q : engine_queues_) q->Push(msg);
-  for (auto t : engine_threads_) t->join();
-
-  for (auto& it : store_) {
-    if (it.second.tensor) {
-      free(it.second.tensor);
-    }
-  }
-
-  for (auto& it : fp16_copy_) {
-    if (it.second.tensor) {
-      free(it.second.tensor);
-    }
-  }
 
   LOG(INFO) << "byteps has been shutdown";
   return;
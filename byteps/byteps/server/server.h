@@ -16,16 +16,25 @@
 #ifndef BYTEPS_SERVER_H
 #define BYTEPS_SERVER_H
 
+#include <numa.h>
+#include <numaif.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
 #include <set>
 
 #include "../common/compressor/compressor.h"
 #include "../common/compressor/compressor_registry.h"
 #include "../common/cpu_reducer.h"
+#include "key_table.h"
+#include "buffer_pool.h"
+#include "optimizer.h"
+#include "snapshot.h"
+#include "telemetry.h"
 #include "ps/ps.h"
 
 namespace byteps {
@@ -42,10 +51,18 @@ enum class RequestType {
   kDefaultPushPull,
   kRowSparsePushPull,
   kCompressedPushPull,
-  kConfigPushPull
+  kConfigPushPull,
+  kServerUpdatePushPull
 };
 
-enum BytePSEngineOperation { SUM_RECV, COPY_FIRST, ALL_RECV, TERMINATE };
+enum BytePSEngineOperation {
+  SUM_RECV,
+  COPY_FIRST,
+  SUM_FIRST,
+  ALL_RECV,
+  SEND_PULL,  // async mode, after the pushes of the key before it
+  TERMINATE
+};
 
 struct PSKV {
   SArray<Key> keys;  // n keys
@@ -67,6 +84,9 @@ struct BytePSArray {
 struct UpdateBuf {
   std::vector<ps::KVMeta> request;
   BytePSArray merged;
+  // the first push of this round is held in merged.tmp_sarray and not yet
+  // copied into the store
+  bool defer_first = false;
 };
 
 struct BytePSEngineMessage {
@@ -80,6 +100,82 @@ struct BytePSEngineMessage {
   ps::KVPairs<char> sarray;  // to temporarily hold it and auto release
   ps::KVMeta req_meta;
   bool mixed_precision;
+  void* src2;    // second operand of SUM_FIRST
+  bool striped;  // a stripe of a large key, see stripe_size_
+};
+
+// sources of a sum of queued pushes done by an engine thread at once
+constexpr size_t kMaxSumSources = 8;
+
+/**
+ * \brief all the states of a key, padded to whole cache lines so that
+ * neighbouring keys handled by different threads do not share one
+ */
+struct alignas(64) KeySlot {
+  BytePSArray store;      // master copy
+  // the other buffer of store, rounds of plain keys alternate between them
+  char* spare_store = nullptr;
+  BytePSArray fp16_copy;  // for mixed precision
+  UpdateBuf update;
+  // decompress pushed gradients
+  std::unique_ptr<common::compressor::Compressor> compressor;
+  // compress merged results for pull, with its own error-feedback state
+  std::unique_ptr<common::compressor::Compressor> pull_compressor;
+  // reuse the memory address to avoid ibv_reg_mr on RDMA data path
+  ps::KVPairs<char> push_response;
+  ps::KVPairs<char> pull_response;
+  // engine thread of the key, -1 if not assigned yet
+  std::atomic<int> tid{-1};
+  // engine thread picked by the rebalancer, -1 if no migration is pending
+  std::atomic<int> next_tid{-1};
+  // engine time spent on the key since the last rebalance
+  std::atomic<uint64_t> cost_ns{0};
+  // estimated workload added to acc_load_
+  uint64_t load = 0;
+  // stripes not summed yet in this round, plus one until all pushes arrive
+  std::atomic<int> stripe_pending{0};
+  // ALL_RECV message sent by the engine thread finishing the last stripe
+  BytePSEngineMessage all_recv;
+  // rounds released to the engine, see backup_worker_num_.
+  // only accessed by the request handler of the key
+  uint64_t quorum_round = 0;
+  // the round that the last push of each worker is counted in
+  std::unordered_map<int, uint64_t> sender_round;
+  // the round whose result each worker pulls next, which is behind
+  // sender_round for a worker whose late push was dropped
+  std::unordered_map<int, uint64_t> pull_round;
+  // rounds whose result is ready to pull, guarded by flag_mu_
+  uint64_t ready_round = 0;
+  // pulls waiting for the result of a round, guarded by flag_mu_
+  std::vector<std::pair<uint64_t, ps::KVMeta>> pending_pulls;
+  // result of the last round, so that the next round summed into the store
+  // by fast workers does not clobber it before slow workers pull it
+  BytePSArray result;
+  // pushes summed into the key in async mode, only accessed by the request
+  // handler of the key
+  uint64_t async_version = 0;
+  // async_version at the last pull of each worker
+  std::unordered_map<int, uint64_t> pulled_version;
+  // the server applies the optimizer and workers pull the updated weights
+  bool server_update = false;
+  // master weights and optimizer states, created at the first round
+  std::unique_ptr<Optimizer> optimizer;
+  // pushes and pulls may carry only some rows, see common/row_sparse.h
+  bool row_sparse = false;
+  // row size of the key, known from the first row-sparse push
+  size_t row_bytes = 0;
+  // rows pushed in this round, pulled back as the result
+  std::vector<uint8_t> row_bitmap;
+  // a worker pushed the dense partition in this round
+  bool dense_round = false;
+  // see BYTEPS_SERVER_TELEMETRY
+  KeyStats stats;
+};
+
+struct BytePSHandleMessage {
+  ps::KVMeta req_meta{};
+  ps::KVPairs<char> req_data;
+  bool terminate = false;
 };
 
 static DataHandleType DepairDataHandleType(int cmd) {
@@ -98,9 +194,8 @@ static DataHandleType DepairDataHandleType(int cmd) {
 KVServer<SERVER_DATA_TYPE>* byteps_server_;
 byteps::common::CpuReducer* bps_reducer_;
 
-std::mutex pullresp_mu_;
-std::unordered_map<uint64_t, ps::KVPairs<char>> push_response_map_;
-std::unordered_map<uint64_t, ps::KVPairs<char>> pull_response_map_;
+// per-key states
+std::unique_ptr<KeyTable<KeySlot>> key_table_;
 
 // push & pull flag
 std::vector<std::mutex> flag_mu_;
@@ -110,33 +205,49 @@ std::vector<std::unordered_map<uint64_t, std::vector<ps::KVMeta>>>
 std::vector<std::unordered_map<uint64_t, std::set<int>>> seen_sender_;
 std::vector<std::unordered_map<uint64_t, size_t>> pull_cnt_;
 
-// byteps handler
-std::mutex handle_mu_;
-std::mutex update_mu_;
-std::unordered_map<uint64_t, UpdateBuf> update_buf_;
-std::unordered_map<uint64_t, std::unique_ptr<common::compressor::Compressor>>
-    compressor_map_;
-
-// address map
-std::mutex store_mu_;
-std::mutex fp16_mu_;
-std::unordered_map<uint64_t, BytePSArray> store_;      // master copy
-std::unordered_map<uint64_t, BytePSArray> fp16_copy_;  // for mixed precision
-
-// hash function
+// engine thread assignment
 std::mutex hash_mu_;
-std::unordered_map<uint64_t, size_t> hash_cache_;
 std::vector<uint64_t>
     acc_load_;  // accumulated tensor size for an engine thread
+// numa node of each engine thread, empty if numa-aware placement is disabled
+std::vector<int> engine_numa_node_;
 
 // global knob
-uint64_t timestamp_ = 0;
+std::atomic<uint64_t> timestamp_{0};
 size_t engine_thread_num_ = 4;
+size_t compress_thread_num_ = 0;
+size_t handler_thread_num_ = 0;
+size_t max_key_num_ = 65536;
+size_t stripe_size_ = 4 * 1024 * 1024;
+size_t rebalance_interval_ = 0;  // in milliseconds
+size_t aggregation_group_size_ = 0;
+size_t engine_queue_size_ = 4096;
+size_t backup_worker_num_ = 0;
+int max_staleness_ = -1;  // unbounded if negative
+OptimizerParams optimizer_params_;
+std::string telemetry_path_;  // disabled if empty
+size_t telemetry_interval_ms_ = 10000;
+std::unique_ptr<Telemetry> telemetry_;
+// arena size of the buffer pool in MB, 0 to allocate buffers one by one
+size_t buffer_pool_mb_ = 0;
+std::unique_ptr<BufferPool> buffer_pool_;
+std::string snapshot_path_;  // disabled if empty
+size_t snapshot_mb_ = 0;
+std::unique_ptr<Snapshot> snapshot_;
 volatile bool is_engine_blocking_ = false;
 volatile bool log_key_info_ = false;
 volatile bool sync_mode_ = true;
 volatile bool debug_mode_ = false;
 volatile bool enable_schedule_ = false;
+volatile bool enable_numa_ = false;
+volatile bool double_buffer_ = false;
+
+// in-process mode, see benchmark.cc. requests are fed to BytePSHandler
+// directly by local_num_workers_ simulated workers, and responses go to
+// response_sink_ instead of ps-lite.
+size_t local_num_workers_ = 0;
+std::function<void(const ps::KVMeta&, const ps::KVPairs<char>&)>
+    response_sink_;
 
 // debug
 uint64_t debug_key_;
@@ -146,25 +257,113 @@ int DivUp(int x, int y) { return (x + y - 1) / y; }
 int RoundUp(int x, int y) { return DivUp(x, y) * y; }
 
 uint64_t DecodeKey(ps::Key key) {
+  if (local_num_workers_) return key;
   auto kr = ps::Postoffice::Get()->GetServerKeyRanges()[ps::MyRank()];
   return key - kr.begin();
 }
 
 uint64_t EncodeKey(ps::Key key) {
+  if (local_num_workers_) return key;
   auto kr = ps::Postoffice::Get()->GetServerKeyRanges()[ps::MyRank()];
   return key + kr.begin();
 }
 
+KeySlot* GetSlot(uint64_t key) { return key_table_->Get(key); }
+
+size_t NumWorkers() {
+  return local_num_workers_ ? local_num_workers_ : ps::NumWorkers();
+}
+
+// number of workers in a group of the aggregation tree
+size_t GetGroupWorkers(int group) {
+  size_t num_workers = NumWorkers();
+  CHECK_LT(group * aggregation_group_size_, num_workers);
+  return std::min(aggregation_group_size_,
+                  num_workers - group * aggregation_group_size_);
+}
+
+size_t GetNumGroups() {
+  return DivUp(NumWorkers(), aggregation_group_size_);
+}
+
+// number of workers pushing a key in each round
+size_t GetNumPushers(uint64_t key) {
+  if (!aggregation_group_size_) return NumWorkers();
+  if (key & common::kTreeRootFlag) return GetNumGroups();
+  auto group = common::GetTreeGroup(key);
+  if (group < 0) return NumWorkers();
+  // only the leader pushes the result
+  if (key & common::kTreeResultFlag) return 1;
+  return GetGroupWorkers(group);
+}
+
+// number of pushes aggregated in each round, the rest are late and dropped
+size_t GetQuorum(uint64_t key) {
+  auto num_pushers = GetNumPushers(key);
+  CHECK_LT(backup_worker_num_, num_pushers)
+      << "BYTEPS_SERVER_BACKUP_WORKERS should be less than the number of "
+         "workers";
+  return num_pushers - backup_worker_num_;
+}
+
+// number of workers pulling a key in each round
+size_t GetNumPullers(uint64_t key) {
+  if (!aggregation_group_size_) return NumWorkers();
+  if (key & common::kTreeRootFlag) return GetNumGroups();
+  auto group = common::GetTreeGroup(key);
+  if (group < 0) return NumWorkers();
+  if (key & common::kTreeResultFlag) return GetGroupWorkers(group) - 1;
+  // only the leader pulls the partial sum
+  return 1;
+}
+
+// number of workers initializing a key
+size_t GetNumIniters(uint64_t key) {
+  if (!aggregation_group_size_) return NumWorkers();
+  if (key & common::kTreeRootFlag) return GetNumGroups();
+  auto group = common::GetTreeGroup(key);
+  if (group < 0) return NumWorkers();
+  return GetGroupWorkers(group);
+}
+
+void MoveToNumaNode(void* ptr, size_t size, int node) {
+  if (!ptr || !size) return;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  // buffers from new[] may not start at a page. their first and last pages
+  // move along with whatever else is in them.
+  auto begin = reinterpret_cast<uintptr_t>(ptr) / page_size * page_size;
+  auto end = reinterpret_cast<uintptr_t>(ptr) + size;
+  auto nodemask = numa_allocate_nodemask();
+  numa_bitmask_setbit(nodemask, node);
+  // prefer the node for later faults and migrate the pages already touched
+  auto ret = mbind(reinterpret_cast<void*>(begin), end - begin, MPOL_PREFERRED,
+                   nodemask->maskp, nodemask->size + 1, MPOL_MF_MOVE);
+  numa_free_nodemask(nodemask);
+  if (ret != 0) {
+    LOG(WARNING) << "failed to move " << size << " bytes to numa node " << node
+                 << ": " << strerror(errno);
+  }
+}
+
+// move the buffers of the compressors of a key, which are allocated and
+// zeroed by the handler thread of the key
+void MoveCompressorsToNumaNode(KeySlot* slot, int node) {
+  auto move = [node](void* ptr, size_t size) {
+    MoveToNumaNode(ptr, size, node);
+  };
+  if (slot->compressor) slot->compressor->ForEachBuffer(move);
+  if (slot->pull_compressor) slot->pull_compressor->ForEachBuffer(move);
+}
+
 size_t GetThreadID(uint64_t key, size_t len) {
+  auto slot = GetSlot(key);
+  int tid = slot->tid.load(std::memory_order_acquire);
+  if (tid >= 0) return tid;
+  CHECK_GT(len, 0) << "pull key=" << key << " before any push";
+
   std::lock_guard<std::mutex> lock(hash_mu_);
-  if (len == 0) {  // pull
-    CHECK_NE(hash_cache_.find(key), hash_cache_.end());
-    return hash_cache_[key];
-  }
-  if (hash_cache_.find(key) != hash_cache_.end()) {
-    return hash_cache_[key];
-  }
-  CHECK_GT(len, 0);
+  tid = slot->tid.load(std::memory_order_relaxed);
+  if (tid >= 0) return tid;
   CHECK_EQ(acc_load_.size(), engine_thread_num_);
   auto min_index = -1;
   auto min_load = std::numeric_limits<uint64_t>::max();
@@ -177,11 +376,23 @@ size_t GetThreadID(uint64_t key, size_t len) {
   CHECK_GE(min_index, 0);
   CHECK_LT(min_index, engine_thread_num_);
   acc_load_[min_index] += len;
-  hash_cache_[key] = min_index;
-  return hash_cache_[key];
+  slot->load = len;
+  if (!engine_numa_node_.empty()) {
+    // place the buffers on the node of the engine thread summing into them
+    auto node = engine_numa_node_[min_index];
+    MoveToNumaNode(slot->store.tensor, slot->store.len, node);
+    MoveToNumaNode(slot->fp16_copy.tensor, slot->fp16_copy.len, node);
+    MoveCompressorsToNumaNode(slot, node);
+  }
+  slot->tid.store(min_index, std::memory_order_release);
+  return min_index;
 }
 
 void PageAlignedMalloc(void** ptr, size_t size) {
+  if (buffer_pool_) {
+    *ptr = buffer_pool_->Alloc(size);
+    return;
+  }
   size_t page_size = sysconf(_SC_PAGESIZE);
   void* p;
   int size_aligned = RoundUp(size, page_size);
@@ -192,6 +403,14 @@ void PageAlignedMalloc(void** ptr, size_t size) {
   *ptr = p;
 }
 
+void PageAlignedFree(void* ptr) {
+  // buffers from the pool are released with the pool
+  if (buffer_pool_) return;
+  // and those in the snapshot are kept for the next server
+  if (snapshot_ && snapshot_->Contains(ptr)) return;
+  free(ptr);
+}
+
 extern "C" void byteps_server();
 
 }  // namespace server
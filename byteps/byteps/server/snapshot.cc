@@ -0,0 +1,171 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "snapshot.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+namespace {
+
+constexpr uint64_t kSnapshotMagic = 0x504e5353505442ULL;  // "BTPSSNP"
+constexpr uint64_t kSnapshotVersion = 1;
+
+size_t RoundUpTo(size_t x, size_t align) {
+  return (x + align - 1) / align * align;
+}
+
+}  // namespace
+
+struct Snapshot::Header {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t max_entries;
+  // entries are appended, and an entry counts once this is increased
+  uint64_t num_entries;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t data_used;
+};
+
+struct Snapshot::Entry {
+  uint64_t key;
+  uint32_t kind;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+};
+
+Snapshot::Snapshot(const std::string& path, size_t max_entries,
+                   size_t data_size)
+    : _path(path) {
+  _fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  CHECK_GE(_fd, 0) << "failed to open the server snapshot " << path << ": "
+                   << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(_fd, &st), 0) << strerror(errno);
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  bool is_new = st.st_size == 0;
+  if (is_new) {
+    auto data_offset =
+        RoundUpTo(sizeof(Header) + max_entries * sizeof(Entry), page_size);
+    _file_size = data_offset + RoundUpTo(data_size, page_size);
+    // sparse, so that only the written pages take space
+    CHECK_EQ(ftruncate(_fd, _file_size), 0)
+        << "failed to size the server snapshot " << path << ": "
+        << strerror(errno);
+  } else {
+    _file_size = st.st_size;
+    CHECK_GE(_file_size, sizeof(Header)) << "corrupted server snapshot "
+                                         << path;
+  }
+  auto p = mmap(nullptr, _file_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd,
+                0);
+  CHECK(p != MAP_FAILED) << "failed to map the server snapshot " << path
+                         << ": " << strerror(errno);
+  _base = static_cast<char*>(p);
+  _header = reinterpret_cast<Header*>(_base);
+
+  if (is_new) {
+    _header->version = kSnapshotVersion;
+    _header->max_entries = max_entries;
+    _header->num_entries = 0;
+    _header->data_offset =
+        RoundUpTo(sizeof(Header) + max_entries * sizeof(Entry), page_size);
+    _header->data_size = _file_size - _header->data_offset;
+    _header->data_used = 0;
+    // the file is valid from now on
+    _header->magic = kSnapshotMagic;
+  } else {
+    CHECK_EQ(_header->magic, kSnapshotMagic)
+        << path << " is not a BytePS server snapshot";
+    CHECK_EQ(_header->version, kSnapshotVersion)
+        << "unsupported version of the server snapshot " << path;
+    CHECK_EQ(_header->data_offset + _header->data_size, _file_size)
+        << "corrupted server snapshot " << path;
+  }
+  _entries = reinterpret_cast<Entry*>(_base + sizeof(Header));
+  _data = _base + _header->data_offset;
+  _data_size = _header->data_size;
+
+  for (size_t i = 0; i < _header->num_entries; ++i) {
+    auto& e = _entries[i];
+    CHECK_LE(e.offset + e.size, _header->data_used)
+        << "corrupted server snapshot " << path;
+    _index[std::make_pair(e.key, e.kind)] = i;
+  }
+  LOG(INFO) << (is_new ? "created" : "mapped") << " the server snapshot "
+            << path << " with " << _header->num_entries << " buffers, "
+            << _header->data_used << " bytes";
+}
+
+Snapshot::~Snapshot() {
+  // the file is kept for the next server
+  munmap(_base, _file_size);
+  close(_fd);
+}
+
+void* Snapshot::Acquire(uint64_t key, uint32_t kind, size_t size,
+                        bool* restored) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto it = _index.find(std::make_pair(key, kind));
+  if (it != _index.end()) {
+    auto& e = _entries[it->second];
+    CHECK_EQ(e.size, size) << "the state of key=" << key
+                           << " in the server snapshot " << _path
+                           << " has a different size, remove the snapshot "
+                              "if the model changed";
+    *restored = true;
+    ++_num_restored;
+    return _data + e.offset;
+  }
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  auto aligned_size = RoundUpTo(std::max<size_t>(size, 1), page_size);
+  CHECK_LT(_header->num_entries, _header->max_entries)
+      << "the index of the server snapshot " << _path << " is full";
+  CHECK_LE(_header->data_used + aligned_size, _header->data_size)
+      << "the server snapshot " << _path << " is full, increase "
+      << "BYTEPS_SERVER_SNAPSHOT_MB and remove it";
+  auto i = _header->num_entries;
+  auto& e = _entries[i];
+  e.key = key;
+  e.kind = kind;
+  e.reserved = 0;
+  e.offset = _header->data_used;
+  e.size = size;
+  _header->data_used += aligned_size;
+  // pages of a new file read as zeros, but a crash may have left data of an
+  // entry that was never counted
+  memset(_data + e.offset, 0, size);
+  _header->num_entries = i + 1;
+  _index[std::make_pair(key, kind)] = i;
+  *restored = false;
+  return _data + e.offset;
+}
+
+}  // namespace server
+}  // namespace byteps
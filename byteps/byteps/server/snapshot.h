@@ -0,0 +1,97 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_SNAPSHOT_H
+#define BYTEPS_SERVER_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace byteps {
+namespace server {
+
+/**
+ * \brief kinds of the state of a key kept in a snapshot
+ */
+enum SnapshotKind : uint32_t {
+  // the store, i.e., the weights in asynchronous training
+  kSnapshotStore = 0,
+  // number of steps taken by the server optimizer
+  kSnapshotOptimizerSteps = 1,
+  // buffers of the server optimizer, from the master weights on
+  kSnapshotOptimizerBuffer = 16,
+};
+
+/**
+ * \brief per-key server state in a memory-mapped file
+ *
+ * The file starts with an index of the buffers in it, followed by the
+ * buffers. Both are updated in place through a shared mapping, so the state
+ * survives the server process, and a restarted server maps the same file to
+ * resume from it. On /dev/shm, the state is kept in memory.
+ */
+class Snapshot {
+ public:
+  /**
+   * \param path the file, created if it does not exist
+   * \param max_entries capacity of the index of a new file
+   * \param data_size bytes of buffers of a new file. pages are only
+   *        allocated when written.
+   */
+  Snapshot(const std::string& path, size_t max_entries, size_t data_size);
+  ~Snapshot();
+
+  /**
+   * \brief get the buffer of the state of a key, allocated zeroed if the
+   *        file does not have it yet
+   *
+   * \param restored set to whether the buffer is from an earlier server
+   */
+  void* Acquire(uint64_t key, uint32_t kind, size_t size, bool* restored);
+
+  /*! \brief whether a buffer is in the snapshot */
+  bool Contains(const void* p) const {
+    return p >= _data && p < _data + _data_size;
+  }
+
+  size_t num_restored() const { return _num_restored; }
+
+ private:
+  struct Header;
+  struct Entry;
+
+  std::string _path;
+  int _fd = -1;
+  char* _base = nullptr;
+  size_t _file_size = 0;
+  Header* _header = nullptr;
+  Entry* _entries = nullptr;
+  char* _data = nullptr;
+  size_t _data_size = 0;
+
+  std::mutex _mu;
+  // (key, kind) -> index of the entry
+  std::map<std::pair<uint64_t, uint32_t>, size_t> _index;
+  size_t _num_restored = 0;
+};
+
+}  // namespace server
+}  // namespace byteps
+
+#endif  // BYTEPS_SERVER_SNAPSHOT_H
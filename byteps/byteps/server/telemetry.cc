@@ -0,0 +1,177 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "ps/ps.h"
+
+namespace byteps {
+namespace server {
+
+namespace {
+
+const char* kStageNames[kNumStages] = {"push_spread", "queue_wait", "sum",
+                                       "compress",    "pull_send",  "round"};
+
+// number of the slowest keys in a dump
+constexpr size_t kNumSlowKeys = 10;
+
+}  // namespace
+
+Histogram::Histogram() {
+  for (auto& b : _buckets) b.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::Bucket(uint64_t ns) {
+  if (ns < 4) return ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int sub = (ns >> (msb - 2)) & 3;
+  return (msb - 1) * 4 + sub;
+}
+
+uint64_t Histogram::BucketMid(int bucket) {
+  if (bucket < 4) return bucket;
+  int msb = bucket / 4 + 1;
+  uint64_t width = 1ULL << (msb - 2);
+  return (4 + bucket % 4) * width + width / 2;
+}
+
+void Histogram::Record(uint64_t ns) {
+  _buckets[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(ns, std::memory_order_relaxed);
+  auto max = _max.load(std::memory_order_relaxed);
+  while (ns > max &&
+         !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t Histogram::Percentile(double q) const {
+  uint64_t n = count();
+  if (!n) return 0;
+  uint64_t rank = std::max<uint64_t>(1, q * n);
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += _buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return std::min(BucketMid(i), max());
+  }
+  return max();
+}
+
+Telemetry::Telemetry(const std::string& path, size_t interval_ms,
+                     KeyCollector collect)
+    : _path(path),
+      _interval_ms(interval_ms),
+      _collect(std::move(collect)),
+      _start_ns(NowNs()) {
+  CHECK_GT(_interval_ms, 0);
+  _thread = std::thread(&Telemetry::DumpThread, this);
+}
+
+Telemetry::~Telemetry() {
+  {
+    std::lock_guard<std::mutex> lock(_mu);
+    _stop = true;
+  }
+  _cv.notify_all();
+  _thread.join();
+  Dump();
+}
+
+void Telemetry::Record(TelemetryStage stage, uint64_t ns, KeyStats* key) {
+  _hist[stage].Record(ns);
+  if (key) key->total[stage].fetch_add(ns, std::memory_order_relaxed);
+}
+
+void Telemetry::FinishRound(KeyStats* key) {
+  Record(kSum, key->round_sum_ns.load(std::memory_order_relaxed), key);
+  Record(kRound, NowNs() - key->first_push_ns, key);
+  key->rounds.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Telemetry::DumpThread() {
+  std::unique_lock<std::mutex> lock(_mu);
+  while (!_cv.wait_for(lock, std::chrono::milliseconds(_interval_ms),
+                       [this] { return _stop; })) {
+    lock.unlock();
+    Dump();
+    lock.lock();
+  }
+}
+
+void Telemetry::Dump() {
+  // write aside and rename, so that readers never see a partial dump
+  auto tmp = _path + ".tmp";
+  auto fp = fopen(tmp.c_str(), "w");
+  if (!fp) {
+    LOG(WARNING) << "failed to open " << tmp << " for server telemetry";
+    return;
+  }
+  fprintf(fp, "# BytePS server telemetry, %.1f s since start, in us\n",
+          (NowNs() - _start_ns) / 1e9);
+  fprintf(fp, "%-12s %10s %10s %10s %10s %10s %10s\n", "stage", "count",
+          "mean", "p50", "p90", "p99", "max");
+  for (int s = 0; s < kNumStages; ++s) {
+    auto& h = _hist[s];
+    auto n = h.count();
+    fprintf(fp, "%-12s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            kStageNames[s], static_cast<unsigned long>(n),
+            n ? h.sum() / 1e3 / n : 0.0, h.Percentile(0.5) / 1e3,
+            h.Percentile(0.9) / 1e3, h.Percentile(0.99) / 1e3, h.max() / 1e3);
+  }
+
+  std::vector<const KeyStats*> keys;
+  _collect(&keys);
+  auto mean_round = [](const KeyStats* k) {
+    auto n = k->rounds.load(std::memory_order_relaxed);
+    return n ? k->total[kRound].load(std::memory_order_relaxed) / n : 0;
+  };
+  keys.erase(std::remove_if(keys.begin(), keys.end(),
+                            [](const KeyStats* k) {
+                              return !k->rounds.load(
+                                  std::memory_order_relaxed);
+                            }),
+             keys.end());
+  auto num_slow = std::min(kNumSlowKeys, keys.size());
+  std::partial_sort(keys.begin(), keys.begin() + num_slow, keys.end(),
+                    [&](const KeyStats* a, const KeyStats* b) {
+                      return mean_round(a) > mean_round(b);
+                    });
+  fprintf(fp, "\n# slowest keys, mean per round\n%-20s %10s", "key",
+          "rounds");
+  for (int s = 0; s < kNumStages; ++s) fprintf(fp, " %12s", kStageNames[s]);
+  fprintf(fp, "\n");
+  for (size_t i = 0; i < num_slow; ++i) {
+    auto k = keys[i];
+    auto n = k->rounds.load(std::memory_order_relaxed);
+    fprintf(fp, "%-20lu %10lu", static_cast<unsigned long>(k->key),
+            static_cast<unsigned long>(n));
+    for (int s = 0; s < kNumStages; ++s) {
+      fprintf(fp, " %12.1f",
+              k->total[s].load(std::memory_order_relaxed) / 1e3 / n);
+    }
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+  if (rename(tmp.c_str(), _path.c_str())) {
+    LOG(WARNING) << "failed to write server telemetry to " << _path;
+  }
+}
+
+}  // namespace server
+}  // namespace byteps
@@ -0,0 +1,154 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_SERVER_TELEMETRY_H
+#define BYTEPS_SERVER_TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace byteps {
+namespace server {
+
+/**
+ * \brief stages of a round of a key on servers
+ */
+enum TelemetryStage {
+  // from the first to the last push of the round, i.e., stragglers
+  kPushSpread,
+  // from the last push to the engine picking up the summed round
+  kQueueWait,
+  // engine time spent summing the pushes of the round
+  kSum,
+  // compressing the result for pull
+  kCompress,
+  // handing a pull response to ps-lite
+  kPullSend,
+  // from the first push to the result being ready to pull
+  kRound,
+  kNumStages
+};
+
+inline uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * \brief lock-free histogram of durations
+ *
+ * Buckets are log-linear: 4 buckets per power of two, so a percentile is off
+ * by at most 1/8 of its value.
+ */
+class Histogram {
+ public:
+  Histogram();
+
+  void Record(uint64_t ns);
+
+  uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+  uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+
+  /*! \brief approximate q-th percentile in nanoseconds */
+  uint64_t Percentile(double q) const;
+
+ private:
+  static constexpr int kNumBuckets = 256;
+
+  static int Bucket(uint64_t ns);
+  static uint64_t BucketMid(int bucket);
+
+  std::atomic<uint64_t> _buckets[kNumBuckets];
+  std::atomic<uint64_t> _count{0};
+  std::atomic<uint64_t> _sum{0};
+  std::atomic<uint64_t> _max{0};
+};
+
+/**
+ * \brief telemetry of a key, kept in its slot
+ */
+struct KeyStats {
+  KeyStats() {
+    for (auto& t : total) t.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t key = 0;
+  // rounds finished
+  std::atomic<uint64_t> rounds{0};
+  // time spent in each stage over all rounds
+  std::atomic<uint64_t> total[kNumStages];
+  // the current round. push times are only accessed by the request handler
+  // of the key, and read by the engine after the pushes are queued.
+  uint64_t first_push_ns = 0;
+  uint64_t last_push_ns = 0;
+  std::atomic<uint64_t> round_sum_ns{0};
+};
+
+/**
+ * \brief per-stage histograms of server rounds, dumped periodically
+ *
+ * The dump overwrites a text file, e.g. on /dev/shm to be read like a shared
+ * memory stats page, with the histograms of all keys and the stages of the
+ * slowest keys.
+ */
+class Telemetry {
+ public:
+  using KeyCollector = std::function<void(std::vector<const KeyStats*>*)>;
+
+  /**
+   * \param path file to dump to
+   * \param interval_ms time between dumps
+   * \param collect lists the stats of all keys
+   */
+  Telemetry(const std::string& path, size_t interval_ms,
+            KeyCollector collect);
+  /*! \brief stop dumping and dump a last time */
+  ~Telemetry();
+
+  void Record(TelemetryStage stage, uint64_t ns, KeyStats* key);
+
+  /*! \brief the result of a round of the key is ready to pull */
+  void FinishRound(KeyStats* key);
+
+  void Dump();
+
+ private:
+  void DumpThread();
+
+  std::string _path;
+  size_t _interval_ms;
+  KeyCollector _collect;
+  uint64_t _start_ns;
+  Histogram _hist[kNumStages];
+
+  std::mutex _mu;
+  std::condition_variable _cv;
+  bool _stop = false;
+  std::thread _thread;
+};
+
+}  // namespace server
+}  // namespace byteps
+
+#endif  // BYTEPS_SERVER_TELEMETRY_H
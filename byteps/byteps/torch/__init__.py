@@ -56,6 +56,13 @@ class _DistributedOptimizer(torch.optim.Optimizer):
                 "Async is only valid for distributed training"
             print('BytePS: enable asynchronous training')
 
+        # servers run the optimizer and return the updated weights
+        self._server_update = bool(os.getenv('BYTEPS_SERVER_OPTIMIZER'))
+        if self._server_update:
+            assert not self._enable_async, \
+                "Server optimizer cannot be used in async training"
+            print('BytePS: enable server optimizer')
+
         # make sure that named_parameters are tuples
         if any([not isinstance(p, tuple) for p in named_parameters]):
             raise ValueError('named_parameters should be a sequence of '
@@ -117,9 +124,31 @@ class _DistributedOptimizer(torch.optim.Optimizer):
                         filter(lambda attr: attr[0].startswith(
                             "byteps_",), param.__dict__.items())
                     )
+                    if self._server_update:
+                        byteps_params["byteps_server_update"] = 1
                     declare("Gradient."+name, **byteps_params)
                     print("Gradient."+name, param.data.numel())
 
+        if self._server_update:
+            self._init_server_weights()
+
+    def _init_server_weights(self):
+        # the first round of each tensor carries the weights instead of the
+        # gradients, servers keep their average as the master weights
+        handles = []
+        for param_group in self.param_groups:
+            for p in param_group['params']:
+                if not p.requires_grad:
+                    continue
+                if self._is_tensor_instance:
+                    name = self._parameter_names.get(p.__hash__())
+                else:
+                    name = self._parameter_names.get(p)
+                handles.append(byteps_push_pull(
+                    p.data, average=False, name="Gradient."+name))
+        for handle in handles:
+            synchronize(handle)
+
     @ staticmethod
     def find_duplicates(lst):
         seen = set()
@@ -193,6 +222,26 @@ class _DistributedOptimizer(torch.optim.Optimizer):
                     setattr(param, "byteps_compressor_k",
                             compression_params["k"])
 
+                # pull direction, share the push-side compressor if not given
+                if compression_params.get("pull_compressor"):
+                    for item in ["compressor", "ef"]:
+                        key = "pull_%s" % item
+                        if compression_params.get(key):
+                            if isinstance(compression_params[key], str):
+                                setattr(param, "byteps_pull_%s_type" %
+                                        item, compression_params[key])
+                            else:
+                                raise TypeError("%s should be str" % key)
+
+                    pull_compressor = compression_params["pull_compressor"]
+                    if pull_compressor == "onebit":
+                        setattr(param, "byteps_pull_compressor_onebit_scaling", str(
+                            compression_params.get("pull_scaling", False)))
+                    elif pull_compressor == "topk" or pull_compressor == "dithering":
+                        # raise KeyError if 'pull_k' is not found
+                        setattr(param, "byteps_pull_compressor_k",
+                                compression_params["pull_k"])
+
                 if compression_params.get("momentum"):
                     setattr(param, "byteps_momentum_mu",
                             optimizer_params["momentum"])
@@ -246,6 +295,11 @@ class _DistributedOptimizer(torch.optim.Optimizer):
         if self._enable_async:
             # the real handle will be created in step()
             handle, ctx = None, None
+        elif self._server_update:
+            tensor = p.grad
+            tensor *= self.pre_scale_factor
+            handle, ctx = byteps_push_pull(
+                tensor, average=False, name="Gradient."+name), None
         else:
             tensor = p.grad
             # grad is scaled with pre_scale_factor
@@ -289,7 +343,10 @@ class _DistributedOptimizer(torch.optim.Optimizer):
         for p, (handle, ctx) in self._handles.items():
             output = synchronize(handle)
             self._push_pull_delay[p] = self.backward_passes_per_step
-            if not self._enable_async:
+            if self._server_update:
+                # output is the weights updated by servers
+                p.data.copy_(output)
+            elif not self._enable_async:
                 g = self._intra_compressors[p].decompress(
                     output, ctx, x=p.data)
 
@@ -335,6 +392,13 @@ class _DistributedOptimizer(torch.optim.Optimizer):
 
             self.synchronize()
             return loss
+        elif self._server_update:
+            loss = None
+            if closure is not None:
+                loss = closure()
+            if self._should_sync:
+                self.synchronize()
+            return loss
         else:
             # skip sync if calling skip_synchronize
             if self._should_sync:
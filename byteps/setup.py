@@ -262,9 +262,11 @@ def get_common_options(build_ext):
                'byteps/common/ready_table.cc',
                'byteps/common/shared_memory.cc',
                'byteps/common/nccl_manager.cc',
-               'byteps/common/cpu_reducer.cc'] + [
+               'byteps/common/cpu_reducer.cc',
+               'byteps/common/row_sparse.cc'] + [
         'byteps/common/compressor/compressor_registry.cc',
         'byteps/common/compressor/error_feedback.cc',
+        'byteps/common/compressor/header.cc',
         'byteps/common/compressor/momentum.cc',
         'byteps/common/compressor/cast.cc',
         'byteps/common/compressor/impl/dithering.cc',
@@ -320,11 +322,17 @@ def build_server(build_ext, options):
     server_lib.define_macros = options['MACROS']
     server_lib.include_dirs = options['INCLUDES']
     server_lib.sources = ['byteps/server/server.cc',
+                          'byteps/server/optimizer.cc',
+                          'byteps/server/telemetry.cc',
+                          'byteps/server/buffer_pool.cc',
+                          'byteps/server/snapshot.cc',
                           'byteps/common/cpu_reducer.cc',
+                          'byteps/common/row_sparse.cc',
                           'byteps/common/logging.cc',
                           'byteps/common/common.cc'] + [
         'byteps/common/compressor/compressor_registry.cc',
         'byteps/common/compressor/error_feedback.cc',
+        'byteps/common/compressor/header.cc',
         'byteps/common/compressor/impl/dithering.cc',
         'byteps/common/compressor/impl/onebit.cc',
         'byteps/common/compressor/impl/randomk.cc',
@@ -343,6 +351,7 @@ def build_server(build_ext, options):
         server_lib.libraries = ['rdmacm', 'ibverbs', 'rt']
     else:
         server_lib.libraries = []
+    server_lib.libraries += ['numa']
     if build_ucx():
         server_lib.libraries += ['ucp', 'uct', 'ucs', 'ucm']
 
@@ -858,10 +867,29 @@ def build_torch_extension(build_ext, options, torch_version):
     build_ext.build_extension(pytorch_lib)
 
 
+# sources that pick their instruction set at runtime. They are built without
+# -march=native, so that their own code dispatches by the CPU it runs on;
+# the other sources still target the build host.
+BASELINE_ISA_SOURCES = ['cpu_reducer.cc']
+
+
+def compile_for_baseline_isa(compiler):
+    original_compile = compiler._compile
+
+    def _compile(obj, src, ext, cc_args, extra_postargs, pp_opts):
+        if os.path.basename(src) in BASELINE_ISA_SOURCES:
+            extra_postargs = [flag for flag in extra_postargs
+                              if not flag.startswith('-march=')]
+        original_compile(obj, src, ext, cc_args, extra_postargs, pp_opts)
+
+    compiler._compile = _compile
+
+
 # run the customize_compiler
 class custom_build_ext(build_ext):
     def build_extensions(self):
         pre_setup.setup()
+        compile_for_baseline_isa(self.compiler)
 
         make_option = ""
         # To resolve tf-gcc incompatibility
@@ -0,0 +1,286 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the AVX2 and AVX-512 kernels of CpuReducer against its scalar
+// paths, which must give the same bits, and of the sum of many sources.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "byteps/common/cpu_reducer.h"
+
+namespace byteps {
+namespace common {
+namespace {
+
+const DataType kTypes[] = {BYTEPS_FLOAT32, BYTEPS_FLOAT64, BYTEPS_FLOAT16,
+                           BYTEPS_UINT8,   BYTEPS_INT32,   BYTEPS_INT8,
+                           BYTEPS_INT64};
+
+// element counts with tails after the vectors of every type, and one that
+// is split across the threads
+const size_t kNumElems[] = {1, 3, 15, 31, 63, 65, 127, 1031, 100003};
+
+const char* LevelName(CpuReducer::SimdLevel level) {
+  return level == CpuReducer::AVX512 ? "avx512"
+                                     : level == CpuReducer::AVX2 ? "avx2"
+                                                                 : "scalar";
+}
+
+std::unique_ptr<CpuReducer> MakeReducer(CpuReducer::SimdLevel level) {
+  setenv("BYTEPS_CPU_REDUCER_SIMD", LevelName(level), 1);
+  return std::unique_ptr<CpuReducer>(new CpuReducer(nullptr));
+}
+
+size_t TypeSize(DataType dtype) {
+  switch (dtype) {
+    case BYTEPS_FLOAT64:
+    case BYTEPS_INT64:
+      return 8;
+    case BYTEPS_FLOAT32:
+    case BYTEPS_INT32:
+      return 4;
+    case BYTEPS_FLOAT16:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// n random elements of dtype, small enough that integer sums never
+// overflow, and finite floats of mixed signs and exponents
+std::vector<char> Random(DataType dtype, size_t n, std::mt19937* gen) {
+  std::vector<char> buf(n * TypeSize(dtype));
+  std::uniform_real_distribution<double> real(-4, 4);
+  std::uniform_int_distribution<int> integer(-30, 30);
+  for (size_t i = 0; i < n; ++i) {
+    switch (dtype) {
+      case BYTEPS_FLOAT32:
+        reinterpret_cast<float*>(buf.data())[i] = real(*gen);
+        break;
+      case BYTEPS_FLOAT64:
+        reinterpret_cast<double*>(buf.data())[i] = real(*gen);
+        break;
+      case BYTEPS_FLOAT16: {
+        // sign, exponent of 2^-5 to 2^5 and mantissa
+        uint16_t sign = (*gen)() & 1;
+        uint16_t exponent = 10 + (*gen)() % 11;
+        uint16_t mantissa = (*gen)() & 0x3ff;
+        reinterpret_cast<uint16_t*>(buf.data())[i] =
+            (sign << 15) | (exponent << 10) | mantissa;
+        break;
+      }
+      case BYTEPS_UINT8:
+        reinterpret_cast<uint8_t*>(buf.data())[i] = integer(*gen) + 30;
+        break;
+      case BYTEPS_INT32:
+        reinterpret_cast<int32_t*>(buf.data())[i] = integer(*gen);
+        break;
+      case BYTEPS_INT8:
+        reinterpret_cast<int8_t*>(buf.data())[i] = integer(*gen);
+        break;
+      case BYTEPS_INT64:
+        reinterpret_cast<int64_t*>(buf.data())[i] = integer(*gen);
+        break;
+      default:
+        BPS_CHECK(0) << "unexpected type " << dtype;
+    }
+  }
+  return buf;
+}
+
+void CheckSame(const std::vector<char>& expected,
+               const std::vector<char>& actual, const char* op,
+               CpuReducer::SimdLevel level, DataType dtype, size_t n) {
+  BPS_CHECK(expected == actual) << op << " of " << LevelName(level)
+                                << " is off for type " << dtype << " and "
+                                << n << " elements";
+}
+
+void TestSum(CpuReducer* scalar, CpuReducer* simd) {
+  std::mt19937 gen(0);
+  auto level = simd->GetSimdLevel();
+  for (auto dtype : kTypes) {
+    for (auto n : kNumElems) {
+      auto len = n * TypeSize(dtype);
+      auto a = Random(dtype, n, &gen);
+      auto b = Random(dtype, n, &gen);
+
+      // dst += src
+      auto expected = a, actual = a;
+      scalar->sum(expected.data(), b.data(), len, dtype);
+      simd->sum(actual.data(), b.data(), len, dtype);
+      CheckSame(expected, actual, "sum", level, dtype, n);
+
+      // dst = src1 + src2
+      std::vector<char> expected2(len), actual2(len);
+      scalar->sum(expected2.data(), a.data(), b.data(), len, dtype);
+      simd->sum(actual2.data(), a.data(), b.data(), len, dtype);
+      CheckSame(expected2, actual2, "sum of two", level, dtype, n);
+
+      // dst = srcs[0] + ... + srcs[4], in place in srcs[0]
+      std::vector<std::vector<char>> srcs;
+      for (int k = 0; k < 5; ++k) srcs.push_back(Random(dtype, n, &gen));
+      std::vector<const void*> ptrs;
+      for (auto& src : srcs) ptrs.push_back(src.data());
+      std::vector<char> expected_n(len);
+      scalar->sum(expected_n.data(), ptrs.data(), ptrs.size(), len, dtype);
+      simd->sum(srcs[0].data(), ptrs.data(), ptrs.size(), len, dtype);
+      CheckSame(expected_n, srcs[0], "sum of many", level, dtype, n);
+
+      // no vector kernel, but dispatched by type all the same
+      expected = a;
+      actual = a;
+      scalar->scale(expected.data(), len, dtype, 0.375f);
+      simd->scale(actual.data(), len, dtype, 0.375f);
+      CheckSame(expected, actual, "scale", level, dtype, n);
+    }
+  }
+}
+
+void TestMixedPrecision(CpuReducer* scalar, CpuReducer* simd) {
+  std::mt19937 gen(1);
+  auto level = simd->GetSimdLevel();
+  for (auto n : kNumElems) {
+    auto half_len = n * 2;
+    auto half = Random(BYTEPS_FLOAT16, n, &gen);
+    auto full = Random(BYTEPS_FLOAT32, n, &gen);
+
+    // float32 dst += float16 src
+    auto expected = full, actual = full;
+    scalar->sum_mixed_precision(expected.data(), half.data(), half_len,
+                                BYTEPS_FLOAT16);
+    simd->sum_mixed_precision(actual.data(), half.data(), half_len,
+                              BYTEPS_FLOAT16);
+    CheckSame(expected, actual, "sum_mixed_precision", level, BYTEPS_FLOAT16,
+              n);
+
+    // float16 to float32, the len is of the float16 buffer
+    std::vector<char> up_expected(n * 4), up_actual(n * 4);
+    scalar->copy_mixed_precision(up_expected.data(), half.data(), half_len,
+                                 BYTEPS_FLOAT16, true);
+    simd->copy_mixed_precision(up_actual.data(), half.data(), half_len,
+                               BYTEPS_FLOAT16, true);
+    CheckSame(up_expected, up_actual, "copy up", level, BYTEPS_FLOAT16, n);
+
+    // float32 to float16, rounded to nearest even
+    std::vector<char> down_expected(half_len), down_actual(half_len);
+    scalar->copy_mixed_precision(down_expected.data(), full.data(), half_len,
+                                 BYTEPS_FLOAT16, false);
+    simd->copy_mixed_precision(down_actual.data(), full.data(), half_len,
+                               BYTEPS_FLOAT16, false);
+    CheckSame(down_expected, down_actual, "copy down", level, BYTEPS_FLOAT16,
+              n);
+  }
+}
+
+// the sum of many sources against pairwise sums, except for float16, which
+// is summed in float32 and rounded once
+void TestSumMany(CpuReducer* reducer) {
+  std::mt19937 gen(2);
+  auto level = reducer->GetSimdLevel();
+  for (auto dtype : kTypes) {
+    for (auto n : kNumElems) {
+      auto len = n * TypeSize(dtype);
+      for (size_t num_srcs : {2, 3, 8}) {
+        std::vector<std::vector<char>> srcs;
+        for (size_t k = 0; k < num_srcs; ++k) {
+          srcs.push_back(Random(dtype, n, &gen));
+        }
+        std::vector<const void*> ptrs;
+        for (auto& src : srcs) ptrs.push_back(src.data());
+
+        auto expected = srcs[0];
+        if (dtype == BYTEPS_FLOAT16) {
+          std::vector<float> acc(n, 0.0f), up(n);
+          for (auto& src : srcs) {
+            reducer->copy_mixed_precision(up.data(), src.data(), len, dtype,
+                                          true);
+            for (size_t i = 0; i < n; ++i) acc[i] += up[i];
+          }
+          reducer->copy_mixed_precision(expected.data(), acc.data(), len,
+                                        dtype, false);
+        } else {
+          for (size_t k = 1; k < num_srcs; ++k) {
+            reducer->sum(expected.data(), srcs[k].data(), len, dtype);
+          }
+        }
+
+        // into another buffer, then in place of the first source
+        std::vector<char> actual(len);
+        reducer->sum(actual.data(), ptrs.data(), num_srcs, len, dtype);
+        CheckSame(expected, actual, "sum of many", level, dtype, n);
+        reducer->sum(srcs[0].data(), ptrs.data(), num_srcs, len, dtype);
+        CheckSame(expected, srcs[0], "sum of many in place", level, dtype, n);
+      }
+    }
+  }
+}
+
+void TestSingleThreadThreshold() {
+  unsetenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD");
+  unsetenv("BYTEPS_CPU_REDUCER_CALIBRATE");
+  BPS_CHECK_EQ(MakeReducer(CpuReducer::SCALAR)->GetSingleThreadThreshold(),
+               64 << 10);
+  setenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD", "12345", 1);
+  BPS_CHECK_EQ(MakeReducer(CpuReducer::SCALAR)->GetSingleThreadThreshold(),
+               12345);
+  // a size between 4KB and 4MB, or never with a single thread
+  unsetenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD");
+  setenv("BYTEPS_CPU_REDUCER_CALIBRATE", "1", 1);
+  auto threshold = MakeReducer(CpuReducer::SCALAR)->GetSingleThreadThreshold();
+  BPS_CHECK(threshold == std::numeric_limits<size_t>::max() ||
+            (threshold >= (4 << 10) && threshold <= (4 << 20)))
+      << threshold;
+  unsetenv("BYTEPS_CPU_REDUCER_CALIBRATE");
+}
+
+void TestLevels() {
+  // with and without the threads
+  for (auto threshold : {"0", "1000000000"}) {
+    setenv("BYTEPS_CPU_REDUCER_SINGLE_THREAD_THRESHOLD", threshold, 1);
+    auto scalar = MakeReducer(CpuReducer::SCALAR);
+    BPS_CHECK_EQ(scalar->GetSimdLevel(), CpuReducer::SCALAR);
+    TestSumMany(scalar.get());
+    for (auto level : {CpuReducer::AVX2, CpuReducer::AVX512}) {
+      auto simd = MakeReducer(level);
+      if (simd->GetSimdLevel() != level) {
+        printf("skipped %s, not supported\n", LevelName(level));
+        continue;
+      }
+      TestSum(scalar.get(), simd.get());
+      TestSumMany(simd.get());
+      TestMixedPrecision(scalar.get(), simd.get());
+    }
+  }
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::common;
+  TestSingleThreadThreshold();
+  TestLevels();
+  printf("cpu reducer tests passed\n");
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the header in front of compressed payloads.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "byteps/common/compressor/compressor_registry.h"
+#include "byteps/common/compressor/header.h"
+#include "byteps/common/logging.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+
+std::unique_ptr<Compressor> Create(const std::string& type, size_t size) {
+  kwargs_t kwargs{{"compressor_type", type}, {"compressor_k", "4"}};
+  auto compressor = CompressorRegistry::Create(kwargs, size, BYTEPS_FLOAT32);
+  BPS_CHECK(compressor);
+  return compressor;
+}
+
+void TestAlgo() {
+  BPS_CHECK(GetCompressorAlgo("onebit") == CompressorAlgo::kOnebit);
+  BPS_CHECK(GetCompressorAlgo("topk") == CompressorAlgo::kTopk);
+  BPS_CHECK(GetCompressorAlgo("randomk") == CompressorAlgo::kRandomk);
+  BPS_CHECK(GetCompressorAlgo("dithering") == CompressorAlgo::kDithering);
+  BPS_CHECK(GetCompressorAlgo("fp16") == CompressorAlgo::kUnknown);
+}
+
+void TestTopk() {
+  const size_t n = 1000;
+  std::vector<float> grad(n, 0.5f);
+  const size_t top[] = {3, 100, 517, 999};
+  for (auto i : top) grad[i] = 100.0f + i;
+
+  auto compressor = Create("topk", n * sizeof(float));
+  tensor_t input(grad.data(), n * sizeof(float), BYTEPS_FLOAT32), compressed;
+  compressor->Compress(input, compressed);
+
+  auto header = ParseHeader(compressed);
+  BPS_CHECK_EQ(header->magic, kPayloadMagic);
+  BPS_CHECK_EQ(header->version, kPayloadVersion);
+  BPS_CHECK_EQ(header->algo, static_cast<uint8_t>(CompressorAlgo::kTopk));
+  BPS_CHECK_EQ(header->dtype, BYTEPS_FLOAT32);
+  BPS_CHECK_EQ(header->flags, kIndexedPayload | kSparsePayload);
+  BPS_CHECK_EQ(header->num_elem, n);
+  // 4 pairs of 32-bit index and value
+  BPS_CHECK_EQ(compressed.size, sizeof(PayloadHeader) + 4 * 8);
+
+  // decompress a copy, as the compressor reuses its buffer
+  std::vector<char> payload(compressed.data, compressed.data + compressed.size);
+  std::vector<float> out(n, -1.0f);
+  tensor_t decompressed(out.data(), n * sizeof(float), BYTEPS_FLOAT32);
+  compressor->Decompress(
+      tensor_t(payload.data(), payload.size(), BYTEPS_FLOAT32), decompressed);
+  for (size_t i = 0; i < n; ++i) {
+    bool is_top = std::find(std::begin(top), std::end(top), i) != std::end(top);
+    BPS_CHECK_EQ(out[i], is_top ? grad[i] : 0.0f) << "at " << i;
+  }
+}
+
+void TestOnebit() {
+  // onebit packs whole words of signs, and tensors are padded to them
+  const size_t n = 320;
+  std::vector<float> grad(n);
+  for (size_t i = 0; i < n; ++i) grad[i] = (i % 3) ? 1.0f : -1.0f;
+
+  auto compressor = Create("onebit", n * sizeof(float));
+  tensor_t input(grad.data(), n * sizeof(float), BYTEPS_FLOAT32), compressed;
+  compressor->Compress(input, compressed);
+
+  auto header = ParseHeader(compressed);
+  BPS_CHECK_EQ(header->algo, static_cast<uint8_t>(CompressorAlgo::kOnebit));
+  BPS_CHECK_EQ(header->flags, 0);
+  BPS_CHECK_EQ(header->num_elem, n);
+
+  std::vector<char> payload(compressed.data, compressed.data + compressed.size);
+  std::vector<float> out(n);
+  tensor_t decompressed(out.data(), n * sizeof(float), BYTEPS_FLOAT32);
+  compressor->Decompress(
+      tensor_t(payload.data(), payload.size(), BYTEPS_FLOAT32), decompressed);
+  for (size_t i = 0; i < n; ++i) {
+    // signs are kept, scaled by the mean magnitude
+    BPS_CHECK_EQ(out[i] > 0, grad[i] > 0) << "at " << i;
+  }
+}
+
+// compressing into a caller buffer, as the server does for pulls, writes
+// the header and at most the size given to the compressor after it
+void TestOutputBuffer() {
+  const size_t n = 256;
+  std::vector<float> grad(n, 1.0f);
+  auto compressor = Create("randomk", n * sizeof(float));
+  const char kGuard = 0x5a;
+  std::vector<char> buf(sizeof(PayloadHeader) + n * sizeof(float) + 64,
+                        kGuard);
+  tensor_t input(grad.data(), n * sizeof(float), BYTEPS_FLOAT32),
+      compressed(buf.data());
+  compressor->Compress(input, compressed);
+  BPS_CHECK(compressed.data == buf.data());
+  BPS_CHECK_LE(compressed.size, sizeof(PayloadHeader) + n * sizeof(float));
+  for (size_t i = compressed.size; i < buf.size(); ++i) {
+    BPS_CHECK_EQ(buf[i], kGuard) << "overflow at " << i;
+  }
+  BPS_CHECK_EQ(ParseHeader(compressed)->flags, kSparsePayload);
+}
+
+}  // namespace
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::common::compressor;
+  TestAlgo();
+  TestTopk();
+  TestOnebit();
+  TestOutputBuffer();
+  printf("header tests passed\n");
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the table of per-key slots of the server.
+
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "byteps/common/logging.h"
+#include "byteps/server/key_table.h"
+
+namespace byteps {
+namespace server {
+namespace {
+
+int live_slots = 0;
+
+struct alignas(64) Slot {
+  Slot() { ++live_slots; }
+  ~Slot() { --live_slots; }
+  uint64_t key = 0;
+  std::atomic<int> hits{0};
+};
+
+// keys are (tensor id << 16) + partition id
+uint64_t Key(uint64_t i) { return ((i / 4) << 16) + i % 4; }
+
+void TestInsert() {
+  {
+    // more slots than a chunk
+    const size_t n = 3000;
+    KeyTable<Slot> table(n);
+    BPS_CHECK(!table.Find(Key(0)));
+    std::vector<Slot*> slots;
+    for (size_t i = 0; i < n; ++i) {
+      auto slot = table.Get(Key(i));
+      BPS_CHECK_EQ(reinterpret_cast<uintptr_t>(slot) % 64, 0);
+      slot->key = Key(i);
+      slots.push_back(slot);
+    }
+    BPS_CHECK_EQ(table.size(), n);
+    BPS_CHECK_EQ(live_slots, n);
+    for (size_t i = 0; i < n; ++i) {
+      // slots never move
+      BPS_CHECK_EQ(table.Find(Key(i)), slots[i]);
+      BPS_CHECK_EQ(table.Get(Key(i)), slots[i]);
+      BPS_CHECK_EQ(slots[i]->key, Key(i));
+    }
+    BPS_CHECK(!table.Find(Key(n)));
+
+    size_t count = 0;
+    // in the order of insertion
+    table.ForEach([&count](Slot* slot) {
+      BPS_CHECK_EQ(slot->key, Key(count));
+      ++count;
+    });
+    BPS_CHECK_EQ(count, n);
+  }
+  BPS_CHECK_EQ(live_slots, 0);
+}
+
+// threads look up and insert the same keys at the same time
+void TestConcurrentGet() {
+  const size_t n = 2048;
+  const int kThreads = 4;
+  KeyTable<Slot> table(n);
+  std::vector<std::vector<Slot*>> seen(kThreads, std::vector<Slot*>(n));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&table, &seen, t, n] {
+      for (size_t i = 0; i < n; ++i) {
+        // every thread starts at a different key
+        size_t k = (i + t * n / kThreads) % n;
+        auto slot = table.Get(Key(k));
+        slot->hits.fetch_add(1);
+        seen[t][k] = slot;
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  BPS_CHECK_EQ(table.size(), n);
+  std::set<Slot*> distinct;
+  for (size_t k = 0; k < n; ++k) {
+    for (int t = 0; t < kThreads; ++t) BPS_CHECK_EQ(seen[t][k], seen[0][k]);
+    BPS_CHECK_EQ(seen[0][k]->hits.load(), kThreads);
+    distinct.insert(seen[0][k]);
+  }
+  BPS_CHECK_EQ(distinct.size(), n);
+}
+
+}  // namespace
+}  // namespace server
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::server;
+  TestInsert();
+  TestConcurrentGet();
+  printf("key table tests passed\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the optimizers running on servers, against a plain reference
+// computed in double.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "byteps/common/logging.h"
+#include "byteps/server/optimizer.h"
+
+namespace byteps {
+namespace server {
+namespace {
+
+// odd, so that vectorized loops have a tail
+const size_t kNumElem = 37;
+const int kSteps = 5;
+
+// reference update of w by the gradient g at step t, starting from 1
+using RefStep = void (*)(const OptimizerParams& p, int t,
+                         const std::vector<double>& g, std::vector<double>* w,
+                         std::vector<double>* m, std::vector<double>* v);
+
+void RefSGD(const OptimizerParams& p, int t, const std::vector<double>& g,
+            std::vector<double>* w, std::vector<double>* m,
+            std::vector<double>* v) {
+  for (size_t i = 0; i < w->size(); ++i) {
+    double d = g[i] + p.weight_decay * (*w)[i];
+    (*m)[i] = p.momentum * (*m)[i] + d;
+    (*w)[i] -= p.lr * (p.momentum != 0 ? (*m)[i] : d);
+  }
+}
+
+void RefAdam(const OptimizerParams& p, int t, const std::vector<double>& g,
+             std::vector<double>* w, std::vector<double>* m,
+             std::vector<double>* v) {
+  double c1 = 1 - std::pow(p.beta1, t), c2 = 1 - std::pow(p.beta2, t);
+  for (size_t i = 0; i < w->size(); ++i) {
+    (*m)[i] = p.beta1 * (*m)[i] + (1 - p.beta1) * g[i];
+    (*v)[i] = p.beta2 * (*v)[i] + (1 - p.beta2) * g[i] * g[i];
+    double u = (*m)[i] / c1 / (std::sqrt((*v)[i] / c2) + p.eps);
+    (*w)[i] -= p.lr * (u + p.weight_decay * (*w)[i]);
+  }
+}
+
+void RefLAMB(const OptimizerParams& p, int t, const std::vector<double>& g,
+             std::vector<double>* w, std::vector<double>* m,
+             std::vector<double>* v) {
+  double c1 = 1 - std::pow(p.beta1, t), c2 = 1 - std::pow(p.beta2, t);
+  std::vector<double> u(w->size());
+  double w_norm = 0, u_norm = 0;
+  for (size_t i = 0; i < w->size(); ++i) {
+    (*m)[i] = p.beta1 * (*m)[i] + (1 - p.beta1) * g[i];
+    (*v)[i] = p.beta2 * (*v)[i] + (1 - p.beta2) * g[i] * g[i];
+    u[i] = (*m)[i] / c1 / (std::sqrt((*v)[i] / c2) + p.eps) +
+           p.weight_decay * (*w)[i];
+    w_norm += (*w)[i] * (*w)[i];
+    u_norm += u[i] * u[i];
+  }
+  double ratio = (w_norm > 0 && u_norm > 0) ? std::sqrt(w_norm / u_norm) : 1;
+  for (size_t i = 0; i < w->size(); ++i) (*w)[i] -= p.lr * ratio * u[i];
+}
+
+void Check(const OptimizerParams& params, RefStep ref) {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(-1, 1);
+  std::vector<float> init(kNumElem);
+  for (auto& x : init) x = dist(gen);
+
+  // the weights start as the pushed values scaled, e.g., averaged
+  const float scale = 0.5f;
+  auto opt = CreateOptimizer(params, kNumElem);
+  BPS_CHECK_EQ(opt->num_elem(), kNumElem);
+  BPS_CHECK(!opt->restored());
+  opt->Init(init.data(), scale);
+  std::vector<double> w(kNumElem), m(kNumElem), v(kNumElem);
+  for (size_t i = 0; i < kNumElem; ++i) w[i] = init[i] * scale;
+
+  std::vector<float> grad(kNumElem);
+  std::vector<double> g(kNumElem);
+  for (int t = 1; t <= kSteps; ++t) {
+    for (size_t i = 0; i < kNumElem; ++i) g[i] = grad[i] = dist(gen);
+    opt->Step(grad.data());
+    ref(params, t, g, &w, &m, &v);
+    for (size_t i = 0; i < kNumElem; ++i) {
+      BPS_CHECK_LE(std::fabs(opt->weight()[i] - w[i]),
+                   1e-5 * (1 + std::fabs(w[i])))
+          << params.type << " step " << t << " at " << i << ": "
+          << opt->weight()[i] << " vs " << w[i];
+    }
+  }
+}
+
+void TestSGD() {
+  OptimizerParams params;
+  params.type = "sgd";
+  params.lr = 0.1;
+  Check(params, RefSGD);
+  params.momentum = 0.9;
+  params.weight_decay = 0.01;
+  Check(params, RefSGD);
+}
+
+void TestAdam() {
+  OptimizerParams params;
+  params.type = "adam";
+  params.lr = 0.01;
+  Check(params, RefAdam);
+  params.weight_decay = 0.01;
+  Check(params, RefAdam);
+}
+
+void TestLAMB() {
+  OptimizerParams params;
+  params.type = "lamb";
+  params.lr = 0.01;
+  params.weight_decay = 0.01;
+  Check(params, RefLAMB);
+}
+
+}  // namespace
+}  // namespace server
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::server;
+  TestSGD();
+  TestAdam();
+  TestLAMB();
+  printf("optimizer tests passed\n");
+  return 0;
+}
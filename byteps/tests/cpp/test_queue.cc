@@ -0,0 +1,152 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the queues feeding the server engine threads. It includes
+// server.h for the message type, so it is linked without server.o.
+
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "byteps/server/server.h"
+#include "byteps/server/queue.h"
+
+namespace byteps {
+namespace server {
+namespace {
+
+void TestRingFull() {
+  // rounded up to 4 cells
+  MPSCRing<std::unique_ptr<int>> ring(3);
+  for (int i = 0; i < 4; ++i) {
+    BPS_CHECK(ring.TryPush(std::unique_ptr<int>(new int(i))));
+  }
+  std::unique_ptr<int> value(new int(4));
+  BPS_CHECK(!ring.TryPush(std::move(value)));
+  // not moved from when the ring is full
+  BPS_CHECK(value);
+  BPS_CHECK_EQ(*value, 4);
+
+  std::unique_ptr<int> popped;
+  for (int i = 0; i < 4; ++i) {
+    BPS_CHECK(ring.TryPop(&popped));
+    BPS_CHECK_EQ(*popped, i);
+    if (i == 0) BPS_CHECK(ring.TryPush(std::move(value)));
+  }
+  BPS_CHECK(ring.TryPop(&popped));
+  BPS_CHECK_EQ(*popped, 4);
+  BPS_CHECK(!ring.TryPop(&popped));
+}
+
+// producers push through a small ring, so that they often find it full and
+// the consumer often finds it empty and parks
+void TestRingProducers() {
+  const int kProducers = 4;
+  const uint64_t kValues = 100000;
+  MPSCRing<uint64_t> ring(8);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&ring, p] {
+      for (uint64_t i = 0; i < kValues; ++i) {
+        uint64_t value = (static_cast<uint64_t>(p) << 32) | i;
+        if (p % 2) {
+          ring.Push(value);
+        } else {
+          while (!ring.TryPush(std::move(value))) std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::vector<uint64_t> next(kProducers, 0);
+  for (uint64_t n = 0; n < kProducers * kValues; ++n) {
+    uint64_t value;
+    ring.WaitAndPop(&value);
+    int p = value >> 32;
+    BPS_CHECK_LT(p, kProducers);
+    // the values of a producer arrive in order
+    BPS_CHECK_EQ(value & 0xffffffff, next[p]) << "producer " << p;
+    ++next[p];
+  }
+  for (auto& t : producers) t.join();
+  uint64_t value;
+  BPS_CHECK(!ring.TryPop(&value));
+}
+
+BytePSEngineMessage Message(uint64_t id, uint64_t key) {
+  BytePSEngineMessage msg;
+  msg.id = id;
+  msg.key = key;
+  msg.ops = SUM_RECV;
+  return msg;
+}
+
+void TestMPSCQueue() {
+  MPSCQueue q(2);
+  BPS_CHECK(q.TryPush(Message(0, 1)));
+  q.Push(Message(1, 2));
+  BPS_CHECK(!q.TryPush(Message(2, 3)));
+  BytePSEngineMessage msg;
+  BPS_CHECK(q.TryPop(&msg));
+  BPS_CHECK_EQ(msg.id, 0);
+  q.WaitAndPop(&msg);
+  BPS_CHECK_EQ(msg.id, 1);
+  BPS_CHECK(!q.TryPop(&msg));
+}
+
+void TestPriorityQueue() {
+  PriorityQueue q;
+  q.Push(Message(0, 1));
+  q.Push(Message(1, 1));
+  q.Push(Message(2, 2));
+  BPS_CHECK(q.TryPush(Message(3, 3)));
+  q.Push(Message(4, 3));
+  q.Push(Message(5, 3));
+
+  // keys with fewer pushes first
+  BytePSEngineMessage msg;
+  q.WaitAndPop(&msg);
+  BPS_CHECK_EQ(msg.id, 2);
+  // then arrival order among keys of the same priority
+  q.WaitAndPop(&msg);
+  BPS_CHECK_EQ(msg.id, 0);
+  q.WaitAndPop(&msg);
+  BPS_CHECK_EQ(msg.id, 1);
+
+  // a new round of key 1 goes after key 3, unless its counter is cleared
+  q.Push(Message(6, 1));
+  q.ClearCounter(1);
+  q.WaitAndPop(&msg);
+  BPS_CHECK_EQ(msg.id, 6);
+  for (uint64_t id = 3; id <= 5; ++id) {
+    BPS_CHECK(q.TryPop(&msg));
+    BPS_CHECK_EQ(msg.id, id);
+  }
+  BPS_CHECK(!q.TryPop(&msg));
+}
+
+}  // namespace
+}  // namespace server
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::server;
+  TestRingFull();
+  TestRingProducers();
+  TestMPSCQueue();
+  TestPriorityQueue();
+  printf("queue tests passed\n");
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the codec of row-sparse partitions.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "byteps/common/logging.h"
+#include "byteps/common/row_sparse.h"
+
+namespace byteps {
+namespace common {
+namespace {
+
+// 16 floats per row, and a last row of 5 floats
+const size_t kRowElem = 16;
+const size_t kNumElem = 100 * kRowElem + 5;
+const size_t kLen = kNumElem * sizeof(float);
+const size_t kRowBytes = kRowElem * sizeof(float);
+const size_t kNumRows = 101;
+
+bool TestBit(const uint8_t* bitmap, size_t i) {
+  return bitmap[i / 8] & (1 << (i % 8));
+}
+
+// a partition with the given rows set to row + 1 + i / 100
+std::vector<float> Partition(const std::vector<size_t>& rows) {
+  std::vector<float> dense(kNumElem, 0.0f);
+  for (auto row : rows) {
+    size_t end = std::min(kNumElem, (row + 1) * kRowElem);
+    for (size_t i = row * kRowElem; i < end; ++i) {
+      dense[i] = row + 1 + i / 100.0f;
+    }
+  }
+  return dense;
+}
+
+void TestBitmapSize() {
+  // padded to 8 bytes
+  BPS_CHECK_EQ(RowSparseBitmapSize(64 * kRowBytes, kRowBytes), 8);
+  BPS_CHECK_EQ(RowSparseBitmapSize(64 * kRowBytes + 1, kRowBytes), 16);
+  BPS_CHECK_EQ(RowSparseBitmapSize(kLen, kRowBytes), 16);
+}
+
+void TestRoundTrip() {
+  // the first, a middle and the partial last row
+  auto dense = Partition({0, 7, 100});
+  std::vector<char> payload(kLen);
+  auto size = EncodeRowSparse(reinterpret_cast<const char*>(dense.data()),
+                              kLen, kRowBytes, nullptr, payload.data());
+  BPS_CHECK_EQ(size, sizeof(RowSparseHeader) + 16 + 2 * kRowBytes +
+                         5 * sizeof(float));
+  auto header = reinterpret_cast<const RowSparseHeader*>(payload.data());
+  BPS_CHECK_EQ(header->row_bytes, kRowBytes);
+  BPS_CHECK_EQ(header->num_rows, 3);
+  auto bitmap = GetRowSparseBitmap(payload.data());
+  for (size_t row = 0; row < kNumRows; ++row) {
+    BPS_CHECK_EQ(TestBit(bitmap, row), row == 0 || row == 7 || row == 100)
+        << "row " << row;
+  }
+
+  // the rows not in the payload are zeroed
+  std::vector<float> out(kNumElem, -1.0f);
+  DecodeRowSparse(payload.data(), size, reinterpret_cast<char*>(out.data()),
+                  kLen);
+  BPS_CHECK(out == dense);
+}
+
+void TestBitmap() {
+  auto dense = Partition({3, 9});
+  // rows given by a bitmap are encoded even if zero, the others are not
+  std::vector<uint8_t> rows(RowSparseBitmapSize(kLen, kRowBytes), 0);
+  rows[0] = 1 << 3;
+  rows[1] = 1 << 2;  // row 10
+  std::vector<char> payload(kLen);
+  auto size = EncodeRowSparse(reinterpret_cast<const char*>(dense.data()),
+                              kLen, kRowBytes, rows.data(), payload.data());
+  BPS_CHECK_EQ(size, sizeof(RowSparseHeader) + 16 + 2 * kRowBytes);
+
+  std::vector<float> out(kNumElem, -1.0f);
+  DecodeRowSparse(payload.data(), size, reinterpret_cast<char*>(out.data()),
+                  kLen);
+  BPS_CHECK(out == Partition({3}));
+}
+
+void TestDense() {
+  // not smaller than the dense partition
+  std::vector<size_t> rows;
+  for (size_t row = 0; row < kNumRows; ++row) rows.push_back(row);
+  auto dense = Partition(rows);
+  std::vector<char> payload(kLen);
+  BPS_CHECK_EQ(EncodeRowSparse(reinterpret_cast<const char*>(dense.data()),
+                               kLen, kRowBytes, nullptr, payload.data()),
+               0);
+  // nor when the bitmap does not fit in it
+  BPS_CHECK_EQ(EncodeRowSparse(reinterpret_cast<const char*>(dense.data()), 16,
+                               4, nullptr, payload.data()),
+               0);
+}
+
+void TestScatterAdd() {
+  auto dense = Partition({1, 100});
+  std::vector<char> payload(kLen);
+  auto size = EncodeRowSparse(reinterpret_cast<const char*>(dense.data()),
+                              kLen, kRowBytes, nullptr, payload.data());
+  BPS_CHECK_GT(size, 0);
+
+  auto sum = Partition({1, 2});
+  auto expected = sum;
+  for (size_t i = 0; i < kNumElem; ++i) expected[i] += dense[i];
+  std::vector<uint8_t> bitmap(RowSparseBitmapSize(kLen, kRowBytes), 0);
+  bitmap[0] = 1 << 5;  // kept
+  ScatterAddRowSparse(payload.data(), size, reinterpret_cast<char*>(sum.data()),
+                      kLen, BYTEPS_FLOAT32, bitmap.data());
+  BPS_CHECK(sum == expected);
+  for (size_t row = 0; row < kNumRows; ++row) {
+    BPS_CHECK_EQ(TestBit(bitmap.data(), row),
+                 row == 1 || row == 5 || row == 100)
+        << "row " << row;
+  }
+}
+
+}  // namespace
+}  // namespace common
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::common;
+  TestBitmapSize();
+  TestRoundTrip();
+  TestBitmap();
+  TestDense();
+  TestScatterAdd();
+  printf("row sparse tests passed\n");
+  return 0;
+}
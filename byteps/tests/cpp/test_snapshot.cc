@@ -0,0 +1,161 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Tests of the memory-mapped snapshot of server states, across a restart of
+// the server simulated by mapping the same file again.
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "byteps/common/logging.h"
+#include "byteps/server/optimizer.h"
+#include "byteps/server/snapshot.h"
+
+namespace byteps {
+namespace server {
+namespace {
+
+const size_t kMaxEntries = 16;
+const size_t kDataSize = 1 << 20;
+
+std::string TempPath() {
+  char path[] = "/tmp/byteps_snapshot_XXXXXX";
+  int fd = mkstemp(path);
+  BPS_CHECK_GE(fd, 0);
+  close(fd);
+  // left empty, so it is a new snapshot
+  return path;
+}
+
+bool IsZero(const char* p, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (p[i]) return false;
+  }
+  return true;
+}
+
+void TestRestart() {
+  auto path = TempPath();
+  const size_t size = 1000;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  {
+    Snapshot snapshot(path, kMaxEntries, kDataSize);
+    bool restored = true;
+    auto p = static_cast<char*>(
+        snapshot.Acquire(1, kSnapshotStore, size, &restored));
+    BPS_CHECK(!restored);
+    BPS_CHECK(snapshot.Contains(p));
+    BPS_CHECK_EQ(reinterpret_cast<uintptr_t>(p) % page_size, 0);
+    BPS_CHECK(IsZero(p, size));
+    memset(p, 0x11, size);
+
+    // the same buffer while the server runs
+    BPS_CHECK_EQ(snapshot.Acquire(1, kSnapshotStore, size, &restored), p);
+    BPS_CHECK(restored);
+
+    // other kinds and keys get their own pages
+    auto q = static_cast<char*>(
+        snapshot.Acquire(1, kSnapshotOptimizerSteps, 8, &restored));
+    BPS_CHECK(!restored);
+    BPS_CHECK_GE(q, p + size);
+    memset(q, 0x22, 8);
+    auto r = static_cast<char*>(
+        snapshot.Acquire(2, kSnapshotStore, size, &restored));
+    BPS_CHECK(!restored);
+    BPS_CHECK_GE(r, q + 8);
+    BPS_CHECK(!snapshot.Contains(&restored));
+  }
+  {
+    // restarted
+    Snapshot snapshot(path, kMaxEntries, kDataSize);
+    BPS_CHECK_EQ(snapshot.num_restored(), 0);
+    bool restored = false;
+    auto q = static_cast<char*>(
+        snapshot.Acquire(1, kSnapshotOptimizerSteps, 8, &restored));
+    BPS_CHECK(restored);
+    BPS_CHECK_EQ(q[0], 0x22);
+    auto p = static_cast<char*>(
+        snapshot.Acquire(1, kSnapshotStore, size, &restored));
+    BPS_CHECK(restored);
+    std::vector<char> expected(size, 0x11);
+    BPS_CHECK_EQ(memcmp(p, expected.data(), size), 0);
+    auto s = static_cast<char*>(
+        snapshot.Acquire(3, kSnapshotStore, size, &restored));
+    BPS_CHECK(!restored);
+    BPS_CHECK(IsZero(s, size));
+    BPS_CHECK_EQ(snapshot.num_restored(), 2);
+  }
+  unlink(path.c_str());
+}
+
+// the optimizer keeps its weights, states and step count in the snapshot
+void TestOptimizer() {
+  auto path = TempPath();
+  OptimizerParams params;
+  params.type = "adam";
+  const size_t n = 33;
+  std::vector<float> init(n, 1.0f), grad(n, 0.25f);
+  std::vector<float> weight;
+  {
+    Snapshot snapshot(path, kMaxEntries, kDataSize);
+    auto opt = CreateOptimizer(params, n, &snapshot, 7);
+    BPS_CHECK(!opt->restored());
+    opt->Init(init.data(), 1.0f);
+    opt->Step(grad.data());
+    opt->Step(grad.data());
+    weight.assign(opt->weight(), opt->weight() + n);
+  }
+  {
+    Snapshot snapshot(path, kMaxEntries, kDataSize);
+    auto opt = CreateOptimizer(params, n, &snapshot, 7);
+    BPS_CHECK(opt->restored());
+    BPS_CHECK(snapshot.Contains(opt->weight()));
+    for (size_t i = 0; i < n; ++i) BPS_CHECK_EQ(opt->weight()[i], weight[i]);
+
+    // resumes at the third step, so it matches an optimizer that never
+    // stopped
+    opt->Step(grad.data());
+    auto reference = CreateOptimizer(params, n);
+    reference->Init(init.data(), 1.0f);
+    for (int t = 0; t < 3; ++t) reference->Step(grad.data());
+    for (size_t i = 0; i < n; ++i) {
+      BPS_CHECK_EQ(opt->weight()[i], reference->weight()[i]) << "at " << i;
+    }
+
+    // another key is not restored
+    auto other = CreateOptimizer(params, n, &snapshot, 8);
+    BPS_CHECK(!other->restored());
+  }
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace server
+}  // namespace byteps
+
+int main() {
+  using namespace byteps::server;
+  TestRestart();
+  TestOptimizer();
+  printf("snapshot tests passed\n");
+  return 0;
+}